@@ -0,0 +1,189 @@
+// append.h
+
+#include <cstdint>
+#include <fstream>
+#include <iostream>
+#include <string>
+#include <vector>
+#include <sys/stat.h>
+
+
+// a field of a line of a CSV written by writeToCSV, which has no quoted
+// fields, or an empty string if the line has too few fields
+std::string csvField(const std::string& line, int index) {
+    size_t start = 0;
+    for (int field = 0; field < index; field++) {
+        start = line.find(',', start);
+        if (start == std::string::npos) {
+            return "";
+        }
+        start++;
+    }
+    size_t end = line.find(',', start);
+    return line.substr(start, end == std::string::npos ? std::string::npos : end - start);
+}
+
+
+// the barcodes of a library written by writeToCSV, in RNA, which are loaded
+// when designs are appended to the library. They are cached next to the
+// library in a compact form, two bits per base, together with the size and
+// modification time of the CSV they were read from, so that the library is
+// only read again if it has changed since.
+class BarcodeCache {
+    public:
+        std::vector<std::string> barcodes;
+
+        // whether the barcodes were loaded from the cache, rather than the CSV
+        bool loadedFromCache = false;
+
+        BarcodeCache(std::string libraryFilename) {
+            this->libraryFilename = libraryFilename;
+            this->cacheFilename = libraryFilename + ".barcodes";
+        }
+
+        // load the barcodes from the cache if it matches the library, and
+        // otherwise from the library, rewriting the cache
+        void load() {
+            this->loadedFromCache = this->readCache();
+            if (!this->loadedFromCache) {
+                this->readLibrary();
+                this->save();
+            }
+        }
+
+        // add the barcodes of newly appended designs, after the library has
+        // been appended to, and write the cache for the library as it is now
+        void append(const std::vector<std::string>& barcodes) {
+            for (const std::string& barcode : barcodes) {
+                if (!barcode.empty() && barcode != "N") {
+                    this->barcodes.push_back(::toRNA(barcode));
+                }
+            }
+            this->save();
+        }
+
+        void save() {
+            uint64_t size, modified;
+            if (!this->libraryStatus(size, modified)) {
+                return;
+            }
+            std::ofstream file(this->cacheFilename, std::ios::binary);
+            if (!file.is_open()) {
+                std::cerr << "Unable to write the barcode cache: " << this->cacheFilename << std::endl;
+                return;
+            }
+            uint64_t count = this->barcodes.size();
+            file.write(BarcodeCache::MAGIC, 8);
+            file.write((const char*) &size, sizeof(size));
+            file.write((const char*) &modified, sizeof(modified));
+            file.write((const char*) &count, sizeof(count));
+
+            // each barcode is its length and its packed bases, or, if any base
+            // cannot be packed, its length with the top bit set and its bases
+            std::string packed;
+            for (const std::string& barcode : this->barcodes) {
+                uint16_t length = barcode.size();
+                packed.assign((barcode.size() + 3) / 4, 0);
+                for (int i = 0; i < barcode.size() && length == barcode.size(); i++) {
+                    int8_t code = packedBaseCode(barcode[i]);
+                    if (code < 0) {
+                        length |= 0x8000;
+                    }
+                    packed[i / 4] |= (code & 3) << (2 * (i % 4));
+                }
+                file.write((const char*) &length, sizeof(length));
+                if (length & 0x8000) {
+                    file.write(barcode.data(), barcode.size());
+                } else {
+                    file.write(packed.data(), packed.size());
+                }
+            }
+        }
+
+    private:
+        static constexpr const char* MAGIC = "FLDBC01\n";
+        std::string libraryFilename;
+        std::string cacheFilename;
+
+        bool libraryStatus(uint64_t& size, uint64_t& modified) {
+            struct stat status;
+            if (stat(this->libraryFilename.c_str(), &status) != 0) {
+                return false;
+            }
+            size = status.st_size;
+            modified = (uint64_t) status.st_mtim.tv_sec * 1000000000ULL + status.st_mtim.tv_nsec;
+            return true;
+        }
+
+        bool readCache() {
+            std::ifstream file(this->cacheFilename, std::ios::binary);
+            uint64_t size, modified, cachedSize, cachedModified, count;
+            char magic[8];
+            if (!file.is_open() || !this->libraryStatus(size, modified)) {
+                return false;
+            }
+            file.read(magic, 8);
+            file.read((char*) &cachedSize, sizeof(cachedSize));
+            file.read((char*) &cachedModified, sizeof(cachedModified));
+            file.read((char*) &count, sizeof(count));
+            if (!file || std::string(magic, 8) != BarcodeCache::MAGIC || cachedSize != size || cachedModified != modified) {
+                return false;
+            }
+
+            const char rnaBases[4] = {'A', 'C', 'G', 'U'};
+            std::vector<std::string> barcodes(count);
+            std::string packed;
+            for (std::string& barcode : barcodes) {
+                uint16_t length;
+                file.read((char*) &length, sizeof(length));
+                if (length & 0x8000) {
+                    barcode.resize(length & 0x7fff);
+                    file.read(&barcode[0], barcode.size());
+                    continue;
+                }
+                packed.resize((length + 3) / 4);
+                file.read(&packed[0], packed.size());
+                barcode.resize(length);
+                for (int i = 0; i < length; i++) {
+                    barcode[i] = rnaBases[(packed[i / 4] >> (2 * (i % 4))) & 3];
+                }
+            }
+            if (!file) {
+                return false;
+            }
+            this->barcodes = std::move(barcodes);
+            return true;
+        }
+
+        // read the barcode column of the library, which writeToCSV writes
+        // without quotes
+        void readLibrary() {
+            std::ifstream file(this->libraryFilename);
+            if (!file.is_open()) {
+                std::cerr << "Unable to open file: " << this->libraryFilename << std::endl;
+                exit(EXIT_FAILURE);
+            }
+            this->barcodes.clear();
+            std::string line;
+            std::getline(file, line);
+            while (std::getline(file, line)) {
+                std::string barcode = csvField(line, 5);
+                if (!barcode.empty() && barcode != "N") {
+                    this->barcodes.push_back(::toRNA(barcode));
+                }
+            }
+        }
+};
+
+
+// read the design regions of a library written by writeToCSV
+std::vector<std::string> readDesignRegions(std::string libraryFilename) {
+    std::vector<std::string> designRegions;
+    std::ifstream file(libraryFilename);
+    std::string line;
+    std::getline(file, line);
+    while (std::getline(file, line)) {
+        designRegions.push_back(csvField(line, 3));
+    }
+    return designRegions;
+}
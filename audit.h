@@ -0,0 +1,146 @@
+// audit.h
+
+#include <algorithm>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+
+// the bases of a barcode at which the audited barcodes differ, packed two
+// bits per base into two 64-bit words
+typedef unsigned __int128 AuditKey;
+
+const int AUDIT_MAX_POSITIONS = 64;
+
+
+// the number of bases at which two packed sequences differ, by folding each
+// two-bit base of their XOR into one bit and counting the bits
+int packedHammingDistance(AuditKey a, AuditKey b) {
+    AuditKey difference = a ^ b;
+    AuditKey bases = (difference | (difference >> 1)) & (((AuditKey) 0x5555555555555555ULL << 64) | 0x5555555555555555ULL);
+    return __builtin_popcountll((uint64_t) bases) + __builtin_popcountll((uint64_t) (bases >> 64));
+}
+
+
+// a pair of barcodes, by their index in the audited list, and their distance
+typedef struct {
+    int first;
+    int second;
+    int distance;
+} BarcodePair;
+
+
+// find every pair of barcodes at a Hamming distance below threshold. The
+// barcodes must all have the same length, and may differ at up to 64 bases.
+// The bases at which the barcodes differ are split into threshold blocks; by
+// the pigeonhole principle a pair within the threshold agrees on at least one
+// block, so only barcodes that share a block are compared, and each pair is
+// reported only in the first block it shares. Bases shared by every barcode,
+// such as the loop, are left out of the packed barcodes and the blocks, since
+// they do not separate any pair.
+std::vector<BarcodePair> findClosePairs(const std::vector<std::string>& barcodes, int threshold) {
+    std::vector<BarcodePair> pairs;
+    if (barcodes.size() < 2 || threshold <= 0) {
+        return pairs;
+    }
+    int length = barcodes[0].size();
+
+    // find the bases at which any of the barcodes differ from the first
+    std::vector<char> varying = parallelReduce(barcodes.size(), std::vector<char>(length, 0), [&](long long begin, long long end) {
+        std::vector<char> differs(length, 0);
+        for (long long i = begin; i < end; i++) {
+            for (int j = 0; j < length; j++) {
+                differs[j] |= packedBaseCode(barcodes[i][j]) != packedBaseCode(barcodes[0][j]);
+            }
+        }
+        return differs;
+    }, [](std::vector<char> a, const std::vector<char>& b) {
+        for (int j = 0; j < a.size(); j++) {
+            a[j] |= b[j];
+        }
+        return a;
+    });
+    std::vector<int> positions;
+    for (int i = 0; i < length; i++) {
+        if (varying[i]) {
+            positions.push_back(i);
+        }
+    }
+    if (positions.size() > AUDIT_MAX_POSITIONS) {
+        std::cerr << "Error: barcodes that differ at more than " << AUDIT_MAX_POSITIONS << " bases cannot be audited." << std::endl;
+        exit(EXIT_FAILURE);
+    }
+
+    // pack the varying bases of every barcode
+    std::vector<AuditKey> packed(barcodes.size());
+    parallelFor(barcodes.size(), [&](long long begin, long long end, int thread) {
+        for (long long i = begin; i < end; i++) {
+            AuditKey key = 0;
+            for (int position : positions) {
+                key = (key << 2) | (packedBaseCode(barcodes[i][position]) & 3);
+            }
+            packed[i] = key;
+        }
+    });
+
+    // split the varying bases into blocks
+    int numBlocks = std::max(1, std::min(threshold, (int) positions.size()));
+    std::vector<AuditKey> masks(numBlocks, 0);
+    for (int i = 0; i < positions.size(); i++) {
+        masks[i * numBlocks / positions.size()] |= (AuditKey) 3 << (2 * (positions.size() - 1 - i));
+    }
+
+    std::vector<std::vector<BarcodePair> > found(NUM_THREADS);
+    for (int block = 0; block < numBlocks; block++) {
+
+        // sort the barcodes by their bases in the block, so that barcodes that
+        // agree on the block are adjacent
+        std::vector<std::pair<AuditKey, int> > keys(barcodes.size());
+        for (int i = 0; i < barcodes.size(); i++) {
+            keys[i] = {packed[i] & masks[block], i};
+        }
+        std::sort(keys.begin(), keys.end());
+        std::vector<std::pair<long long, long long> > groups;
+        for (long long begin = 0, end = 0; begin < keys.size(); begin = end) {
+            while (end < keys.size() && keys[end].first == keys[begin].first) {
+                end++;
+            }
+            if (end - begin > 1) {
+                groups.push_back({begin, end});
+            }
+        }
+
+        // compare every pair within each group
+        parallelFor(groups.size(), [&](long long begin, long long end, int thread) {
+            for (long long group = begin; group < end; group++) {
+                for (long long i = groups[group].first; i < groups[group].second; i++) {
+                    AuditKey a = packed[keys[i].second];
+                    for (long long j = i + 1; j < groups[group].second; j++) {
+                        AuditKey b = packed[keys[j].second];
+                        int distance = packedHammingDistance(a, b);
+                        if (distance >= threshold) {
+                            continue;
+                        }
+                        bool seenInEarlierBlock = false;
+                        for (int earlier = 0; earlier < block && !seenInEarlierBlock; earlier++) {
+                            seenInEarlierBlock = ((a ^ b) & masks[earlier]) == 0;
+                        }
+                        if (!seenInEarlierBlock) {
+                            int first = std::min(keys[i].second, keys[j].second);
+                            int second = std::max(keys[i].second, keys[j].second);
+                            found[thread].push_back({first, second, distance});
+                        }
+                    }
+                }
+            }
+        });
+    }
+
+    for (std::vector<BarcodePair>& threadPairs : found) {
+        pairs.insert(pairs.end(), threadPairs.begin(), threadPairs.end());
+    }
+    std::sort(pairs.begin(), pairs.end(), [](const BarcodePair& a, const BarcodePair& b) {
+        return a.first != b.first ? a.first < b.first : a.second < b.second;
+    });
+    return pairs;
+}
@@ -0,0 +1,433 @@
+// bench.cpp
+
+#include <argparse/argparse.hpp>
+#include "library.h"
+#include "synthetic.h"
+#include <functional>
+#include <map>
+#include <sstream>
+#include <iomanip>
+#include <unistd.h>
+
+using std::string;
+
+
+// a sink that benchmarked results are folded into, so that the compiler cannot
+// optimise the benchmarked work away
+volatile size_t BENCHMARK_SINK = 0;
+
+
+typedef struct {
+    std::string name;
+    long long iterations;
+    long long items;
+    double seconds;
+} BenchmarkResult;
+
+
+// silence std::cout for the lifetime of the object, since the library prints
+// progress messages that would otherwise drown out the benchmark output
+class QuietScope {
+    public:
+        QuietScope() {
+            this->previous = std::cout.rdbuf(this->sink.rdbuf());
+        }
+
+        ~QuietScope() {
+            std::cout.rdbuf(this->previous);
+        }
+
+    private:
+        std::ostringstream sink;
+        std::streambuf* previous;
+};
+
+
+// run a benchmark repeatedly until at least minSeconds have elapsed. The
+// benchmark returns the number of items it processed per call.
+BenchmarkResult runBenchmark(
+    std::string name,
+    std::function<long long()> benchmark,
+    double minSeconds
+    ) {
+    long long iterations = 0;
+    long long items = 0;
+    std::chrono::duration<double> elapsed(0);
+    QuietScope quiet;
+    auto start = std::chrono::steady_clock::now();
+    do {
+        items += benchmark();
+        iterations++;
+        elapsed = std::chrono::steady_clock::now() - start;
+    } while (elapsed.count() < minSeconds);
+    return {name, iterations, items, elapsed.count()};
+}
+
+
+// read the ns per item of each benchmark in a JSON file previously written by
+// writeResults. Each benchmark is written on its own line, so the file is
+// scanned line by line rather than fully parsed.
+std::map<std::string, double> readBaseline(std::string filename) {
+    std::map<std::string, double> baseline;
+    std::ifstream file(filename);
+    if (!file.is_open()) {
+        std::cerr << "Unable to open file: " << filename << std::endl;
+        exit(EXIT_FAILURE);
+    }
+    std::string line;
+    while (std::getline(file, line)) {
+        size_t namePosition = line.find("\"name\": \"");
+        size_t nsPosition = line.find("\"ns_per_item\": ");
+        if (namePosition == std::string::npos || nsPosition == std::string::npos) {
+            continue;
+        }
+        namePosition += 9;
+        std::string name = line.substr(namePosition, line.find('"', namePosition) - namePosition);
+        baseline[name] = std::stod(line.substr(nsPosition + 15));
+    }
+    return baseline;
+}
+
+
+double nsPerItem(BenchmarkResult& result) {
+    return result.items > 0 ? 1e9 * result.seconds / result.items : 0;
+}
+
+
+void writeResults(
+    std::string filename,
+    std::vector<BenchmarkResult>& results,
+    std::map<std::string, double>& baseline
+    ) {
+    std::ostringstream json;
+    json << "{\n  \"benchmarks\": [\n";
+    for (int i = 0; i < results.size(); i++) {
+        BenchmarkResult& result = results[i];
+        json << "    {\"name\": \"" << result.name << "\""
+             << ", \"iterations\": " << result.iterations
+             << ", \"items\": " << result.items
+             << ", \"seconds\": " << result.seconds
+             << ", \"ns_per_item\": " << nsPerItem(result)
+             << ", \"items_per_second\": " << (result.seconds > 0 ? result.items / result.seconds : 0);
+        if (baseline.find(result.name) != baseline.end()) {
+            json << ", \"baseline_ns_per_item\": " << baseline[result.name]
+                 << ", \"speedup\": " << baseline[result.name] / nsPerItem(result);
+        }
+        json << "}" << (i + 1 < results.size() ? ",\n" : "\n");
+    }
+    json << "  ],\n  \"peak_rss_kb\": " << peakResidentSetSize() << "\n}\n";
+
+    if (filename == "-") {
+        std::cout << json.str();
+        return;
+    }
+    std::ofstream file(filename);
+    file << json.str();
+}
+
+
+// run the same sequence of passes as main.cpp over a library, recording each
+// stage in METRICS
+long long runPipeline(std::string pathToCSV, std::string outputDirectory) {
+    int barcodeLength = 13;
+    std::vector<int> maxBasePairCounts = {barcodeLength, 5, 1};
+
+    METRICS.startStage("read");
+    Library library = Library(pathToCSV, "UUCG");
+    METRICS.endStage(library.size());
+
+    METRICS.startStage("verify");
+    library.verifyIsValidNucleicAcid();
+    METRICS.endStage(library.size());
+
+    METRICS.startStage("pad");
+    library.padAllToLengthOnFivePrimeEnd(100, 4, 16, maxBasePairCounts);
+    METRICS.endStage(library.size());
+
+    METRICS.startStage("barcode");
+    library.barcode(barcodeLength, maxBasePairCounts);
+    METRICS.endStage(library.size());
+
+    METRICS.startStage("finalize");
+    library.removeBarcode("N");
+    library.replaceFivePrimeConstantRegion("ACTCGAGTAGAGTCGAAAA");
+    library.replaceThreePrimeConstantRegion("AAAAGAAACAACAACAACAAC");
+    METRICS.endStage(library.size());
+
+    METRICS.startStage("statistics");
+    BENCHMARK_SINK += library.lengthDiscrepancy(170) + library.barcodeDiscrepancy();
+    library.toDNA();
+    METRICS.endStage(library.size());
+
+    METRICS.startStage("write");
+    library.writeToCSV(outputDirectory + "/output.csv");
+    library.writeToFasta(outputDirectory + "/output.fasta");
+    METRICS.endStage(library.size());
+
+    return library.size();
+}
+
+
+int main(int argc, char** argv) {
+
+	argparse::ArgumentParser program("fastLibraryDesignBench");
+
+	program.add_argument("--output")
+		.default_value("-");
+	program.add_argument("--baseline")
+		.default_value("");
+	program.add_argument("--filter")
+		.default_value("");
+
+	program.add_argument("--minTime")
+		.default_value(0.5)
+		.scan<'g', double>();
+	program.add_argument("--ioSize")
+		.default_value(100000)
+		.scan<'d', int>();
+	program.add_argument("--macroSizes")
+		.default_value("10000,100000");
+	program.add_argument("--seed")
+		.default_value(42)
+		.scan<'d', int>();
+
+	try {
+	  program.parse_args(argc, argv);
+	}
+	catch (const std::exception& err) {
+	  std::cerr << err.what() << std::endl;
+	  std::cerr << program;
+	  std::exit(1);
+	}
+
+	string outputFilename = program.get<string>("--output");
+	string baselineFilename = program.get<string>("--baseline");
+	string filter = program.get<string>("--filter");
+	double minTime = program.get<double>("--minTime");
+	int ioSize = program.get<int>("--ioSize");
+	string macroSizes = program.get<string>("--macroSizes");
+	int seed = program.get<int>("--seed");
+
+    // create a scratch directory for the synthetic inputs and outputs
+    std::filesystem::path scratch = std::filesystem::temp_directory_path() / ("fastLibraryDesignBench_" + std::to_string(getpid()));
+    std::filesystem::create_directories(scratch);
+
+    std::string stemLoop = "UUCG";
+    std::vector<int> maxBasePairCounts = {13, 5, 1};
+    srand(seed);
+
+    // the microbenchmarks, each of which returns the number of items it processed
+    std::vector<std::pair<std::string, std::function<long long()> > > benchmarks;
+
+    Barcode barcode = Barcode(13, maxBasePairCounts, stemLoop);
+    benchmarks.push_back({"barcode/construct", [&]() {
+        BENCHMARK_SINK += Barcode(13, maxBasePairCounts, stemLoop).basePairs.size();
+        return 1LL;
+    }});
+    benchmarks.push_back({"barcode/toString", [&]() {
+        BENCHMARK_SINK += barcode.toString().size();
+        return 1LL;
+    }});
+    benchmarks.push_back({"barcode/hammingOneBall", [&]() {
+        BENCHMARK_SINK += barcode.hammingOneBall().size();
+        return 1LL;
+    }});
+
+    // verify candidates against a populated set of barcodes
+    std::unordered_set<std::string> existingBarcodes;
+    for (int i = 0; i < 100000; i++) {
+        existingBarcodes.insert(Barcode(13, maxBasePairCounts, stemLoop).toString());
+    }
+    std::vector<Barcode> candidates;
+    for (int i = 0; i < 1024; i++) {
+        candidates.push_back(Barcode(13, maxBasePairCounts, stemLoop));
+    }
+    long long candidateIndex = 0;
+    benchmarks.push_back({"barcode/verifyHammingDistance/100000", [&]() {
+        BENCHMARK_SINK += candidates[candidateIndex++ % candidates.size()].verifyHammingDistance(existingBarcodes);
+        return 1LL;
+    }});
+
+    // the same against a bitmap of 100000 barcodes with stems of 10 pairs
+    std::vector<int> shortMaxBasePairCounts = {10, 5, 1};
+    BarcodeBitmap existingBitmap = BarcodeBitmap(10, stemLoop);
+    for (int i = 0; i < 100000; i++) {
+        existingBitmap.insert(Barcode(10, shortMaxBasePairCounts, stemLoop).toString());
+    }
+    std::vector<Barcode> shortCandidates;
+    for (int i = 0; i < 1024; i++) {
+        shortCandidates.push_back(Barcode(10, shortMaxBasePairCounts, stemLoop));
+    }
+    benchmarks.push_back({"barcode/verifyHammingDistance/bitmap/100000", [&]() {
+        BENCHMARK_SINK += shortCandidates[candidateIndex++ % shortCandidates.size()].verifyHammingDistance(existingBitmap);
+        return 1LL;
+    }});
+
+    // screen candidates for cross-hybridization against the 100000 barcodes
+    // and the default constant regions. The reverse complement of an accepted
+    // barcode must be rejected, or the screen is not screening anything.
+    HybridizationScreen screen = HybridizationScreen(13, stemLoop.size(), 2, {"ACTCGAGTAGAGTCGAAAA", "AAAAGAAACAACAACAACAAC"});
+    for (const std::string& barcode : existingBarcodes) {
+        screen.accept(barcode);
+    }
+    if (!screen.mayHybridize(reverseComplement(*existingBarcodes.begin()))) {
+        std::cerr << "Error: the hybridization screen accepted the reverse complement of a barcode." << std::endl;
+        exit(EXIT_FAILURE);
+    }
+    benchmarks.push_back({"hybridization/mayHybridize/100000", [&]() {
+        BENCHMARK_SINK += screen.mayHybridize(candidates[candidateIndex++ % candidates.size()].toString());
+        return 1LL;
+    }});
+
+    // the bulk random kernels, per base and per stem barcode
+    std::mt19937 bulkGen(seed);
+    std::string bulkBases(4096, ' ');
+    benchmarks.push_back({"bulkrandom/fillRandomBases/4096", [&]() {
+        fillRandomBases(&bulkBases[0], bulkBases.size(), bulkGen);
+        BENCHMARK_SINK += bulkBases[7];
+        return (long long) bulkBases.size();
+    }});
+    std::string bulkStems(1024 * (26 + stemLoop.size()), ' ');
+    benchmarks.push_back({"bulkrandom/fillRandomStemBarcodes/1024", [&]() {
+        fillRandomStemBarcodes(&bulkStems[0], 1024, 13, maxBasePairCounts, stemLoop, bulkGen);
+        BENCHMARK_SINK += bulkStems[7];
+        return 1024LL;
+    }});
+
+    benchmarks.push_back({"padding/getPadding/45", [&]() {
+        BENCHMARK_SINK += getPadding(45, 4, 16, maxBasePairCounts, stemLoop).size();
+        return 1LL;
+    }});
+
+    // realise and enumerate a degenerate design template
+    std::string degenerateTemplate = "GGAANNNNNNRYKMSWNNNNVDHBNNNNGGAA";
+    std::mt19937 degenerateGen(seed);
+    benchmarks.push_back({"constants/replaceAllPolybasesWithRandomBases", [&]() {
+        BENCHMARK_SINK += replaceAllPolybasesWithRandomBases(degenerateTemplate, degenerateGen)[4];
+        return 1LL;
+    }});
+    benchmarks.push_back({"constants/degenerateExpander/4096", [&]() {
+        DegenerateExpander expander("GGAANNNNNNGGAA");
+        std::string sequence;
+        long long n = 0;
+        while (expander.next(sequence)) {
+            BENCHMARK_SINK += sequence[4];
+            n++;
+        }
+        return n;
+    }});
+
+    // the input and output benchmarks work on synthetic files of ioSize records
+    std::string fastaPath = (scratch / "input.fasta").string();
+    std::string csvPath = (scratch / "input.csv").string();
+    writeSyntheticFasta(fastaPath, ioSize, {40, 60, 80, 120}, seed);
+    writeSyntheticLibraryCSV(csvPath, ioSize, {40, 60, 80}, seed);
+
+    benchmarks.push_back({"fasta/read", [&]() {
+        FastaFile fasta;
+        return (long long) fasta.read(fastaPath).size();
+    }});
+
+    FastaFile fastaFile = FastaFile(fastaPath);
+    benchmarks.push_back({"fasta/getUniqueLengths", [&]() {
+        BENCHMARK_SINK += fastaFile.getUniqueLengths().size();
+        return (long long) fastaFile.size();
+    }});
+    benchmarks.push_back({"fasta/statistics", [&]() {
+        BENCHMARK_SINK += fastaFile.statistics().duplicateSequences;
+        return (long long) fastaFile.size();
+    }});
+    benchmarks.push_back({"fasta/packUnpack", [&]() {
+        fastaFile.pack();
+        fastaFile.unpack();
+        return (long long) fastaFile.size();
+    }});
+    std::vector<PackedSequence> packedSequences;
+    for (FastaRecord& record : fastaFile) {
+        packedSequences.push_back(PackedSequence(record.sequence));
+    }
+    benchmarks.push_back({"packed/reverseComplement", [&]() {
+        for (PackedSequence& sequence : packedSequences) {
+            BENCHMARK_SINK += sequence.reverseComplement().hash();
+        }
+        return (long long) packedSequences.size();
+    }});
+    benchmarks.push_back({"fasta/toDNAtoRNA", [&]() {
+        fastaFile.toDNA();
+        fastaFile.toRNA();
+        return (long long) fastaFile.size();
+    }});
+
+    Library library = Library(csvPath, stemLoop);
+    benchmarks.push_back({"library/lengthDiscrepancy", [&]() {
+        BENCHMARK_SINK += library.lengthDiscrepancy(100);
+        return (long long) library.size();
+    }});
+    benchmarks.push_back({"library/statistics", [&]() {
+        BENCHMARK_SINK += library.statistics().numBarcodes;
+        return (long long) library.size();
+    }});
+    benchmarks.push_back({"library/readFromCSV", [&]() {
+        return (long long) library.readFromCSV(csvPath).size();
+    }});
+    benchmarks.push_back({"library/writeToCSV", [&]() {
+        library.writeToCSV((scratch / "output.csv").string());
+        return (long long) library.size();
+    }});
+    benchmarks.push_back({"library/writeToFasta", [&]() {
+        library.writeToFasta((scratch / "output.fasta").string());
+        return (long long) library.size();
+    }});
+
+    std::vector<BenchmarkResult> results;
+    for (auto& benchmark : benchmarks) {
+        if (benchmark.first.find(filter) == std::string::npos) {
+            continue;
+        }
+        std::cerr << "Running " << benchmark.first << std::endl;
+        results.push_back(runBenchmark(benchmark.first, benchmark.second, minTime));
+    }
+
+    // the macro workloads run the full pipeline once per size, reporting the
+    // total and the time taken by each stage
+    for (std::string size : splitByDelimiter(macroSizes, ',')) {
+        std::string name = "macro/pipeline/" + size;
+        if (size.empty() || name.find(filter) == std::string::npos) {
+            continue;
+        }
+        std::cerr << "Running " << name << std::endl;
+        long long numSequences = std::stoll(size);
+        std::string macroPath = (scratch / ("macro_" + size + ".csv")).string();
+        writeSyntheticLibraryCSV(macroPath, numSequences, {40, 60, 80}, seed);
+
+        METRICS.stages.clear();
+        results.push_back(runBenchmark(name, [&]() {
+            return runPipeline(macroPath, scratch.string());
+        }, 0));
+        for (StageMetrics& stage : METRICS.stages) {
+            results.push_back({name + "/" + stage.name, 1, stage.items, stage.wallSeconds});
+        }
+        std::filesystem::remove(macroPath);
+    }
+
+    std::filesystem::remove_all(scratch);
+
+    // compare against the baseline, if one was given
+    std::map<std::string, double> baseline;
+    if (!baselineFilename.empty()) {
+        baseline = readBaseline(baselineFilename);
+    }
+
+    std::cerr << std::left << std::setw(48) << "benchmark" << std::right << std::setw(16) << "ns/item" << std::setw(16) << "baseline" << std::setw(12) << "speedup" << std::endl;
+    for (BenchmarkResult& result : results) {
+        std::cerr << std::left << std::setw(48) << result.name << std::right << std::setw(16) << std::fixed << std::setprecision(1) << nsPerItem(result);
+        if (baseline.find(result.name) != baseline.end()) {
+            std::cerr << std::setw(16) << baseline[result.name] << std::setw(11) << std::setprecision(2) << baseline[result.name] / nsPerItem(result) << "x";
+        }
+        std::cerr << std::endl;
+    }
+
+    writeResults(outputFilename, results, baseline);
+
+    return 0;
+}
@@ -0,0 +1,122 @@
+// bitmap.h
+
+#include <atomic>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+
+// the longest barcode stem, in base pairs, for which the barcode set is kept
+// as a bitmap: 6^10 barcodes take 7.5 MB
+const int BARCODE_BITMAP_MAX_LENGTH = 10;
+
+
+// the set of stem barcodes of one length and loop as a bitmap over every
+// possible barcode, indexed by the base pairs of its stem as a number in base
+// six, with the innermost pair the lowest digit. Membership is a single bit
+// probe, with no string to build or hash, and bits are set and cleared
+// atomically, so that barcodes may be claimed from several threads at once.
+class BarcodeBitmap {
+    public:
+        int length = 0;
+        std::string stemLoop;
+
+        BarcodeBitmap() {}
+
+        BarcodeBitmap(int length, std::string stemLoop) {
+            this->length = length;
+            this->stemLoop = stemLoop;
+            long long numBarcodes = 1;
+            for (int i = 0; i < length; i++) {
+                this->powers.push_back(numBarcodes);
+                numBarcodes *= 6;
+            }
+            this->words = std::vector<std::atomic<uint64_t> >((numBarcodes + 63) / 64);
+        }
+
+        bool isEnabled() const {
+            return !this->words.empty();
+        }
+
+        // whether the bitmap holds barcodes of this length and loop
+        bool matches(int length, const std::string& stemLoop) const {
+            return this->isEnabled() && this->length == length && this->stemLoop == stemLoop;
+        }
+
+        long long indexOf(const int* basePairs) const {
+            return withStemKernel(this->length, [&](auto kernel) {
+                return kernel.index(basePairs, this->length);
+            });
+        }
+
+        // the index of a barcode as written by Barcode::toString, or -1 if it
+        // is not a stem barcode of this length and loop
+        long long indexOf(const std::string& barcode) const {
+            int loopLength = this->stemLoop.size();
+            if (barcode.size() != 2 * this->length + loopLength || barcode.compare(this->length, loopLength, this->stemLoop) != 0) {
+                return -1;
+            }
+            long long index = 0;
+            for (int i = this->length - 1; i >= 0; i--) {
+                int pair = 0;
+                while (pair < 6 && (PAIR_FIVE_PRIME_BASES[pair] != barcode[this->length - 1 - i] || PAIR_THREE_PRIME_BASES[pair] != barcode[this->length + loopLength + i])) {
+                    pair++;
+                }
+                if (pair == 6) {
+                    return -1;
+                }
+                index = 6 * index + pair;
+            }
+            return index;
+        }
+
+        bool contains(long long index) const {
+            return (this->words[index >> 6].load(std::memory_order_relaxed) >> (index & 63)) & 1;
+        }
+
+        // set the bit of a barcode, returning whether it was clear
+        bool claim(long long index) {
+            uint64_t bit = 1ULL << (index & 63);
+            return !(this->words[index >> 6].fetch_or(bit, std::memory_order_relaxed) & bit);
+        }
+
+        void release(long long index) {
+            this->words[index >> 6].fetch_and(~(1ULL << (index & 63)), std::memory_order_relaxed);
+        }
+
+        void insert(const std::string& barcode) {
+            long long index = this->indexOf(barcode);
+            if (index >= 0) {
+                this->claim(index);
+            }
+        }
+
+        void erase(const std::string& barcode) {
+            long long index = this->indexOf(barcode);
+            if (index >= 0) {
+                this->release(index);
+            }
+        }
+
+        // whether the barcode, or any barcode one base pair away from it as
+        // in Barcode::hammingOneBall, is in the set
+        bool containsNeighbourOf(const int* basePairs) const {
+            long long index = this->indexOf(basePairs);
+            long long probes = 1;
+            bool found = this->contains(index);
+            for (int i = 0; i < this->length && !found; i++) {
+                for (int neighbour : STEM_NEIGHBOURS[basePairs[i]]) {
+                    if (neighbour >= 0 && !found) {
+                        probes++;
+                        found = this->contains(index + (neighbour - basePairs[i]) * this->powers[i]);
+                    }
+                }
+            }
+            METRICS.indexProbes.fetch_add(probes, std::memory_order_relaxed);
+            return found;
+        }
+
+    private:
+        std::vector<long long> powers;
+        std::vector<std::atomic<uint64_t> > words;
+};
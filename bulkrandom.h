@@ -0,0 +1,80 @@
+// bulkrandom.h
+
+#include <array>
+#include <cstdint>
+#include <cstring>
+#include <random>
+#include <string>
+#include <vector>
+
+
+// the four characters of each byte of four 2-bit base codes, lowest bits
+// first, so that a byte of random bits becomes four bases in a single store
+constexpr std::array<std::array<char, 4>, 256> makeBaseQuads() {
+    const char bases[4] = {'A', 'C', 'G', 'U'};
+    std::array<std::array<char, 4>, 256> quads = {};
+    for (int byte = 0; byte < 256; byte++) {
+        for (int i = 0; i < 4; i++) {
+            quads[byte][i] = bases[(byte >> (2 * i)) & 3];
+        }
+    }
+    return quads;
+}
+
+constexpr std::array<std::array<char, 4>, 256> BASE_QUADS = makeBaseQuads();
+
+// the 5' and 3' base of each base pair, in the order of RNA_PAIRS
+constexpr char PAIR_FIVE_PRIME_BASES[6] = {'A', 'U', 'C', 'G', 'G', 'U'};
+constexpr char PAIR_THREE_PRIME_BASES[6] = {'U', 'A', 'G', 'C', 'U', 'G'};
+
+
+// a 64-bit random word from two draws of a 32-bit generator
+uint64_t randomWord(std::mt19937& gen) {
+    uint64_t high = gen();
+    return (high << 32) | gen();
+}
+
+
+// a uniform random integer in [0, bound), by multiplying a 32-bit draw by the
+// bound and rejecting the few draws that would bias the result
+uint32_t randomBelow(uint32_t bound, std::mt19937& gen) {
+    uint64_t product = (uint64_t) (uint32_t) gen() * bound;
+    if ((uint32_t) product < bound) {
+        uint32_t threshold = -bound % bound;
+        while ((uint32_t) product < threshold) {
+            product = (uint64_t) (uint32_t) gen() * bound;
+        }
+    }
+    return product >> 32;
+}
+
+
+// write count random bases to out, taking 32 bases from each 64-bit word
+void fillRandomBases(char* out, long long count, std::mt19937& gen) {
+    for (; count >= 32; count -= 32) {
+        uint64_t word = randomWord(gen);
+        for (int byte = 0; byte < 8; byte++) {
+            std::memcpy(out, BASE_QUADS[(word >> (8 * byte)) & 255].data(), 4);
+            out += 4;
+        }
+    }
+    uint64_t word = count > 0 ? randomWord(gen) : 0;
+    for (long long i = 0; i < count; i++) {
+        *out++ = BASE_QUADS[word & 3][0];
+        word >>= 2;
+    }
+}
+
+
+// write count random bits to out, one per element, taking 64 bits from each
+// 64-bit word
+template <typename T>
+void fillRandomBits(T* out, long long count, std::mt19937& gen) {
+    for (long long i = 0; i < count; i += 64) {
+        uint64_t word = randomWord(gen);
+        for (long long j = i; j < std::min(count, i + 64); j++) {
+            out[j] = word & 1;
+            word >>= 1;
+        }
+    }
+}
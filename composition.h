@@ -0,0 +1,328 @@
+// composition.h
+
+#include <algorithm>
+#include <cstdint>
+#include <iostream>
+#include <random>
+#include <string>
+#include <vector>
+
+
+// the largest number of counting states for which the per-position sampler
+// keeps a table of weights
+const long long COMPOSITION_MAX_TABLE_SIZE = 1 << 22;
+
+
+// a uniform random double in [0, 1)
+double randomUnit(std::mt19937& gen) {
+    return (randomWord(gen) >> 11) * 0x1.0p-53;
+}
+
+
+// shuffle n values with Fisher-Yates, drawing several indices from each 64-bit
+// word: the word is multiplied by each bound in turn, the high half giving an
+// index and the low half carried to the next bound, and the batch is drawn
+// again in the rare case that it would be biased
+void shuffleInBatches(int* values, int n, std::mt19937& gen) {
+    int indices[32];
+    for (int i = n; i > 1; ) {
+        uint64_t product = 1;
+        int k = 0;
+        while (k < 32 && i - k > 1 && product * (i - k) <= (1ULL << 32)) {
+            product *= i - k;
+            k++;
+        }
+        while (true) {
+            uint64_t word = randomWord(gen);
+            for (int t = 0; t < k; t++) {
+                unsigned __int128 scaled = (unsigned __int128) word * (i - t);
+                indices[t] = scaled >> 64;
+                word = (uint64_t) scaled;
+            }
+            if (word >= product || word >= (0 - product) % product) {
+                break;
+            }
+        }
+        for (int t = 0; t < k; t++) {
+            std::swap(values[i - 1 - t], values[indices[t]]);
+        }
+        i -= k;
+    }
+}
+
+
+// samples the base pairs of a stem barcode: length pair types drawn without
+// replacement from a pool of maxOccurences[j] copies of each type j, each in a
+// random orientation. Without per-position constraints, the number of pairs
+// of each type (a multivariate hypergeometric draw) is sampled directly from a
+// table of every possible composition, and the pairs are then put in a random
+// order. With a mask of the allowed base pairs (as bits of their index in
+// RNA_PAIRS) at each position, the pairs are drawn position by position, each
+// weighted by the ways to complete the stem from it, which gives exactly the
+// unconstrained distribution conditioned on the masks.
+class PairCompositionSampler {
+    public:
+        int length = 0;
+        std::vector<int> maxOccurences;
+        std::vector<uint8_t> allowedPairs;
+
+        PairCompositionSampler(
+            int length = 0,
+            std::vector<int> maxOccurences = {},
+            std::vector<uint8_t> allowedPairs = {}
+            ) {
+            this->length = length;
+            this->maxOccurences = maxOccurences;
+            this->allowedPairs = allowedPairs;
+            int poolSize = 0;
+            for (int occurences : maxOccurences) {
+                poolSize += occurences;
+            }
+            if (maxOccurences.empty()) {
+                return;
+            }
+            if (length > poolSize) {
+                std::cout << "Error: a stem of " << length << " base pairs needs more pairs than the " << poolSize << " allowed." << std::endl;
+                exit(EXIT_FAILURE);
+            }
+
+            if (this->isMasked()) {
+                this->buildWeights();
+            } else {
+                std::vector<int> counts(maxOccurences.size());
+                this->addCompositions(counts, 0, length, 1);
+            }
+        }
+
+        bool matches(int length, const std::vector<int>& maxOccurences, const std::vector<uint8_t>& allowedPairs) const {
+            return this->length == length && this->maxOccurences == maxOccurences && this->allowedPairs == allowedPairs;
+        }
+
+        // write the length base pairs of a stem to basePairs
+        void sample(int* basePairs, std::mt19937& gen) const {
+            if (this->isMasked()) {
+                this->sampleByPosition(basePairs, gen);
+                return;
+            }
+            this->sampleTypes(basePairs, gen);
+            for (int i = 0; i < this->length; i += 64) {
+                uint64_t orientations = randomWord(gen);
+                for (int j = i; j < std::min(this->length, i + 64); j++) {
+                    basePairs[j] = 2 * basePairs[j] + (orientations & 1);
+                    orientations >>= 1;
+                }
+            }
+        }
+
+        // write the length pair types of a stem, without their orientations,
+        // to types
+        void sampleTypes(int* types, std::mt19937& gen) const {
+            if (this->isMasked()) {
+                this->sampleByPosition(types, gen);
+                for (int i = 0; i < this->length; i++) {
+                    types[i] /= 2;
+                }
+                return;
+            }
+            double target = randomUnit(gen) * this->cumulativeWeights.back();
+            long long composition = std::upper_bound(this->cumulativeWeights.begin(), this->cumulativeWeights.end(), target) - this->cumulativeWeights.begin();
+            composition = std::min<long long>(composition, this->cumulativeWeights.size() - 1);
+            const uint8_t* counts = &this->compositions[composition * this->maxOccurences.size()];
+            for (int type = 0, i = 0; type < this->maxOccurences.size(); type++) {
+                for (int j = 0; j < counts[type]; j++) {
+                    types[i++] = type;
+                }
+            }
+            shuffleInBatches(types, this->length, gen);
+        }
+
+    private:
+        // the counts of each type in every composition, and their cumulative
+        // weights, which are the number of ways to draw each from the pool
+        std::vector<uint8_t> compositions;
+        std::vector<double> cumulativeWeights;
+
+        // the number of ways to complete the stem from each position and
+        // counting state, where the state is the count of each type so far in
+        // mixed radix
+        std::vector<long long> strides;
+        long long numStates = 0;
+        std::vector<double> weights;
+
+        bool isMasked() const {
+            for (uint8_t mask : this->allowedPairs) {
+                if (mask != 0x3f) {
+                    return true;
+                }
+            }
+            return false;
+        }
+
+        uint8_t maskAt(int position) const {
+            return position < this->allowedPairs.size() ? this->allowedPairs[position] : 0x3f;
+        }
+
+        void addCompositions(std::vector<int>& counts, int type, int remaining, double weight) {
+            if (type + 1 == counts.size()) {
+                if (remaining > this->maxOccurences[type]) {
+                    return;
+                }
+                counts[type] = remaining;
+                weight *= binomial(this->maxOccurences[type], remaining);
+                for (int count : counts) {
+                    this->compositions.push_back(count);
+                }
+                this->cumulativeWeights.push_back((this->cumulativeWeights.empty() ? 0 : this->cumulativeWeights.back()) + weight);
+                return;
+            }
+            for (int count = 0; count <= std::min(remaining, this->maxOccurences[type]); count++) {
+                counts[type] = count;
+                this->addCompositions(counts, type + 1, remaining - count, weight * binomial(this->maxOccurences[type], count));
+            }
+        }
+
+        static double binomial(int n, int k) {
+            double result = 1;
+            for (int i = 1; i <= k; i++) {
+                result = result * (n - k + i) / i;
+            }
+            return result;
+        }
+
+        int countOf(long long state, int type) const {
+            return (state / this->strides[type]) % (this->maxOccurences[type] + 1);
+        }
+
+        void buildWeights() {
+            this->numStates = 1;
+            for (int occurences : this->maxOccurences) {
+                this->strides.push_back(this->numStates);
+                this->numStates *= occurences + 1;
+            }
+            if (this->numStates * (this->length + 1) > COMPOSITION_MAX_TABLE_SIZE) {
+                std::cout << "Error: too many pair types and occurences to constrain stems by position." << std::endl;
+                exit(EXIT_FAILURE);
+            }
+            this->weights.assign(this->numStates * (this->length + 1), 0);
+            for (long long state = 0; state < this->numStates; state++) {
+                this->weights[this->length * this->numStates + state] = 1;
+            }
+            for (int position = this->length - 1; position >= 0; position--) {
+                for (long long state = 0; state < this->numStates; state++) {
+                    double weight = 0;
+                    for (int type = 0; type < this->maxOccurences.size(); type++) {
+                        int remaining = this->maxOccurences[type] - this->countOf(state, type);
+                        if (remaining > 0) {
+                            weight += this->orientationsAt(position, type) * remaining * this->weights[(position + 1) * this->numStates + state + this->strides[type]];
+                        }
+                    }
+                    this->weights[position * this->numStates + state] = weight;
+                }
+            }
+            if (this->weights[0] == 0) {
+                std::cout << "Error: no stem of " << this->length << " base pairs satisfies the allowed base pairs." << std::endl;
+                exit(EXIT_FAILURE);
+            }
+        }
+
+        int orientationsAt(int position, int type) const {
+            uint8_t mask = this->maskAt(position);
+            return ((mask >> (2 * type)) & 1) + ((mask >> (2 * type + 1)) & 1);
+        }
+
+        void sampleByPosition(int* basePairs, std::mt19937& gen) const {
+            long long state = 0;
+            for (int position = 0; position < this->length; position++) {
+                double target = randomUnit(gen) * this->weights[position * this->numStates + state];
+                int chosen = -1;
+                for (int type = 0; type < this->maxOccurences.size(); type++) {
+                    int remaining = this->maxOccurences[type] - this->countOf(state, type);
+                    if (remaining <= 0 || this->orientationsAt(position, type) == 0) {
+                        continue;
+                    }
+                    chosen = type;
+                    target -= this->orientationsAt(position, type) * remaining * this->weights[(position + 1) * this->numStates + state + this->strides[type]];
+                    if (target < 0) {
+                        break;
+                    }
+                }
+
+                // pick an allowed orientation of the chosen type
+                uint8_t mask = this->maskAt(position);
+                int orientation = gen() & 1;
+                if (!((mask >> (2 * chosen + orientation)) & 1)) {
+                    orientation ^= 1;
+                }
+                basePairs[position] = 2 * chosen + orientation;
+                state += this->strides[chosen];
+            }
+        }
+};
+
+
+// parse a comma-separated list of base pairs, such as "GC,CG", into a mask
+// of their indices in RNA_PAIRS
+uint8_t parseBasePairMask(const std::string& pairs) {
+    uint8_t mask = 0;
+    std::string pair;
+    for (int i = 0; i <= pairs.size(); i++) {
+        if (i < pairs.size() && pairs[i] != ',') {
+            pair += pairs[i] == 'T' ? 'U' : pairs[i];
+            continue;
+        }
+        int index = -1;
+        for (int j = 0; j < 6; j++) {
+            if (pair.size() == 2 && pair[0] == PAIR_FIVE_PRIME_BASES[j] && pair[1] == PAIR_THREE_PRIME_BASES[j]) {
+                index = j;
+            }
+        }
+        if (index < 0 && !pair.empty()) {
+            std::cout << "Error: " << pair << " is not a base pair." << std::endl;
+            exit(EXIT_FAILURE);
+        }
+        if (index >= 0) {
+            mask |= 1 << index;
+        }
+        pair.clear();
+    }
+    return mask;
+}
+
+
+// sample the length base pairs of a stem barcode into basePairs, reusing the
+// sampler of the thread while the constraints stay the same
+void sampleStemBasePairs(
+    int* basePairs,
+    int length,
+    const std::vector<int>& maxOccurences,
+    std::mt19937& gen,
+    const std::vector<uint8_t>& allowedPairs = {}
+    ) {
+    thread_local PairCompositionSampler sampler;
+    if (!sampler.matches(length, maxOccurences, allowedPairs)) {
+        sampler = PairCompositionSampler(length, maxOccurences, allowedPairs);
+    }
+    sampler.sample(basePairs, gen);
+}
+
+
+// write count random stem barcodes of length base pairs around stemLoop to
+// out, back to back, each 2 * length plus the length of the loop bases long
+void fillRandomStemBarcodes(
+    char* out,
+    long long count,
+    int length,
+    const std::vector<int>& maxOccurences,
+    const std::string& stemLoop,
+    std::mt19937& gen,
+    const std::vector<uint8_t>& allowedPairs = {}
+    ) {
+    std::vector<int> basePairs(length);
+    long long width = 2 * length + stemLoop.size();
+    withStemKernel(length, [&](auto kernel) {
+        for (long long i = 0; i < count; i++) {
+            sampleStemBasePairs(basePairs.data(), length, maxOccurences, gen, allowedPairs);
+            kernel.write(out + i * width, basePairs.data(), length, stemLoop);
+        }
+    });
+}
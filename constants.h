@@ -1,58 +1,175 @@
 // constants.h
 
+#include <array>
+#include <climits>
+#include <cstdint>
+#include <cstdlib>
+#include <random>
 #include <vector>
 #include <string>
 #include <unordered_set>
 #include <unordered_map>
 
-std::vector<std::string> N_BASES = {"A", "C", "G", "U"};
-std::vector<std::string> R_BASES = {"A", "G"};
-std::vector<std::string> Y_BASES = {"C", "U"};
-std::vector<std::string> K_BASES = {"G", "U"};
-std::vector<std::string> M_BASES = {"A", "C"};
-std::vector<std::string> S_BASES = {"C", "G"};
-std::vector<std::string> W_BASES = {"A", "U"};
-std::vector<std::string> V_BASES = {"A", "C", "G"};
-std::vector<std::string> D_BASES = {"A", "G", "U"};
-std::vector<std::string> H_BASES = {"A", "C", "U"};
-std::vector<std::string> B_BASES = {"C", "G", "U"};
-
-std::unordered_map<std::string, std::vector<std::string> > BASES_DICT = {
-    {"A", {"A"}},
-    {"C", {"C"}},
-    {"G", {"G"}},
-    {"U", {"U"}},
-    {"T", {"T"}},
-    {"N", N_BASES},
-    {"R", R_BASES},
-    {"Y", Y_BASES},
-    {"K", K_BASES},
-    {"M", M_BASES},
-    {"S", S_BASES},
-    {"W", W_BASES},
-    {"V", V_BASES},
-    {"D", D_BASES},
-    {"H", H_BASES},
-    {"B", B_BASES},
-    {"_", N_BASES}
-};
+// the bases that each IUPAC code stands for, as a bitmask with A, C, G and U
+// (or T) as bits 0 to 3, and zero for any other character. The table is built
+// at compile time so that resolving a code is a single lookup.
+constexpr std::array<uint8_t, 256> makeIupacMasks() {
+    std::array<uint8_t, 256> masks = {};
+    masks['A'] = 1;
+    masks['C'] = 2;
+    masks['G'] = 4;
+    masks['U'] = 8;
+    masks['T'] = 8;
+    masks['R'] = 1 | 4;
+    masks['Y'] = 2 | 8;
+    masks['K'] = 4 | 8;
+    masks['M'] = 1 | 2;
+    masks['S'] = 2 | 4;
+    masks['W'] = 1 | 8;
+    masks['V'] = 1 | 2 | 4;
+    masks['D'] = 1 | 4 | 8;
+    masks['H'] = 1 | 2 | 8;
+    masks['B'] = 2 | 4 | 8;
+    masks['N'] = 1 | 2 | 4 | 8;
+    masks['_'] = 1 | 2 | 4 | 8;
+    return masks;
+}
+
+constexpr std::array<uint8_t, 256> IUPAC_MASKS = makeIupacMasks();
+
+
+// the concrete bases that each IUPAC code expands to, in the order A, C, G,
+// U. A T expands to itself, and any other character has no expansion.
+typedef struct {
+    int count;
+    char bases[4];
+} IupacExpansion;
+
+constexpr std::array<IupacExpansion, 256> makeIupacExpansions() {
+    std::array<IupacExpansion, 256> expansions = {};
+    const char rnaBases[4] = {'A', 'C', 'G', 'U'};
+    for (int code = 0; code < 256; code++) {
+        int count = 0;
+        for (int base = 0; base < 4; base++) {
+            if ((IUPAC_MASKS[code] >> base) & 1) {
+                expansions[code].bases[count++] = rnaBases[base];
+            }
+        }
+        expansions[code].count = count;
+    }
+    expansions['T'].bases[0] = 'T';
+    return expansions;
+}
+
+constexpr std::array<IupacExpansion, 256> IUPAC_EXPANSIONS = makeIupacExpansions();
+
+
+constexpr const IupacExpansion& iupacExpansion(char base) {
+    return IUPAC_EXPANSIONS[(unsigned char) base];
+}
 
 
 std::string replacePolybaseWithRandomBase(std::string base) {
-    if (BASES_DICT.find(base) == BASES_DICT.end()) {
+    const IupacExpansion& expansion = iupacExpansion(base[0]);
+    if (base.size() != 1 || expansion.count == 0) {
         return base;
     }
-    return BASES_DICT[base][rand() % BASES_DICT[base].size()];
+    return std::string(1, expansion.bases[rand() % expansion.count]);
 }
 
 std::string replaceAllPolybasesWithRandomBases(std::string sequence) {
-    std::string newSequence = "";
-    for (int i = 0; i < sequence.size(); i++) {
-        newSequence += replacePolybaseWithRandomBase(sequence.substr(i, 1));
+    for (char& base : sequence) {
+        const IupacExpansion& expansion = iupacExpansion(base);
+        if (expansion.count > 1) {
+            base = expansion.bases[rand() % expansion.count];
+        }
     }
-    return newSequence;
+    return sequence;
 }
 
+// replace every degenerate base with one of the bases it stands for, drawing
+// 16 random bits per base so that each call to the generator covers two bases
+std::string replaceAllPolybasesWithRandomBases(std::string sequence, std::mt19937& gen) {
+    uint32_t bits = 0;
+    int available = 0;
+    for (char& base : sequence) {
+        const IupacExpansion& expansion = iupacExpansion(base);
+        if (expansion.count > 1) {
+            if (available == 0) {
+                bits = gen();
+                available = 2;
+            }
+            base = expansion.bases[((bits & 0xffff) * expansion.count) >> 16];
+            bits >>= 16;
+            available--;
+        }
+    }
+    return sequence;
+}
+
+
+// a lazy enumerator of every concrete sequence that a degenerate template
+// stands for. The expansions are produced one at a time, in lexicographic
+// order of the bases at the degenerate positions, so that templates with
+// millions of expansions never have to be held in memory.
+class DegenerateExpander {
+    public:
+        DegenerateExpander(const std::string& degenerateTemplate) {
+            this->current = degenerateTemplate;
+            for (int i = 0; i < this->current.size(); i++) {
+                const IupacExpansion& expansion = iupacExpansion(this->current[i]);
+                if (expansion.count > 1) {
+                    this->positions.push_back(i);
+                    this->expansions.push_back(&expansion);
+                    this->current[i] = expansion.bases[0];
+                }
+            }
+            this->digits.assign(this->positions.size(), 0);
+        }
+
+        // the number of expansions, saturating at the largest value that fits
+        unsigned long long size() const {
+            unsigned long long count = 1;
+            for (const IupacExpansion* expansion : this->expansions) {
+                if (count > ULLONG_MAX / expansion->count) {
+                    return ULLONG_MAX;
+                }
+                count *= expansion->count;
+            }
+            return count;
+        }
+
+        // write the next expansion into sequence, returning false once every
+        // expansion has been produced
+        bool next(std::string& sequence) {
+            if (this->done) {
+                return false;
+            }
+            sequence = this->current;
+
+            // advance the degenerate positions like an odometer, the last fastest
+            this->done = true;
+            for (int i = (int) this->positions.size() - 1; i >= 0; i--) {
+                const IupacExpansion& expansion = *this->expansions[i];
+                if (++this->digits[i] < expansion.count) {
+                    this->current[this->positions[i]] = expansion.bases[this->digits[i]];
+                    this->done = false;
+                    break;
+                }
+                this->digits[i] = 0;
+                this->current[this->positions[i]] = expansion.bases[0];
+            }
+            return true;
+        }
+
+    private:
+        std::string current;
+        std::vector<int> positions;
+        std::vector<const IupacExpansion*> expansions;
+        std::vector<int> digits;
+        bool done = false;
+};
+
 
 
 
@@ -60,6 +177,10 @@ std::string replaceAllPolybasesWithRandomBases(std::string sequence) {
 
 std::unordered_set<std::string> NUCLEIC_BASES = {"A", "C", "G", "U", "T"};
 
+constexpr bool isNucleicBase(char base) {
+    return base == 'A' || base == 'C' || base == 'G' || base == 'U' || base == 'T';
+}
+
 
 
 
@@ -0,0 +1,268 @@
+// constraints.h
+
+#include <array>
+#include <cmath>
+#include <queue>
+#include <string>
+#include <vector>
+
+
+// an Aho-Corasick automaton over a set of forbidden motifs. The automaton is
+// stored as a complete transition table, so that stepping it is a single
+// lookup, and a state is accepting if any motif ends at it.
+class MotifAutomaton {
+    public:
+        std::vector<std::array<int, 4> > transitions;
+        std::vector<bool> accepting;
+
+        // the length of the longest motif that ends at each state, or 0 if
+        // none does, and the length of the longest motif
+        std::vector<int> longestMatch;
+        int maxLength = 0;
+
+        MotifAutomaton(std::vector<std::string> motifs = {}) {
+
+            // build the trie of the motifs
+            this->transitions.push_back({-1, -1, -1, -1});
+            this->accepting.push_back(false);
+            this->longestMatch.push_back(0);
+            for (std::string motif : motifs) {
+                int state = 0;
+                for (char base : motif) {
+                    int index = packedBaseCode(base);
+                    if (index < 0) {
+                        std::cerr << "Error: the motif " << motif << " contains a base other than A, C, G, U or T." << std::endl;
+                        exit(EXIT_FAILURE);
+                    }
+                    if (this->transitions[state][index] < 0) {
+                        this->transitions[state][index] = this->transitions.size();
+                        this->transitions.push_back({-1, -1, -1, -1});
+                        this->accepting.push_back(false);
+                        this->longestMatch.push_back(0);
+                    }
+                    state = this->transitions[state][index];
+                }
+                if (!motif.empty()) {
+                    this->accepting[state] = true;
+                    this->longestMatch[state] = motif.size();
+                    this->maxLength = std::max<int>(this->maxLength, motif.size());
+                }
+            }
+
+            // complete the transitions with the failure links, in breadth first
+            // order so that the failure of every state is complete before it is used
+            std::vector<int> failure(this->transitions.size(), 0);
+            std::queue<int> queue;
+            for (int index = 0; index < 4; index++) {
+                int next = this->transitions[0][index];
+                if (next < 0) {
+                    this->transitions[0][index] = 0;
+                } else {
+                    queue.push(next);
+                }
+            }
+            while (!queue.empty()) {
+                int state = queue.front();
+                queue.pop();
+                this->accepting[state] = this->accepting[state] || this->accepting[failure[state]];
+                if (this->longestMatch[state] == 0) {
+                    this->longestMatch[state] = this->longestMatch[failure[state]];
+                }
+                for (int index = 0; index < 4; index++) {
+                    int next = this->transitions[state][index];
+                    if (next < 0) {
+                        this->transitions[state][index] = this->transitions[failure[state]][index];
+                    } else {
+                        failure[next] = this->transitions[failure[state]][index];
+                        queue.push(next);
+                    }
+                }
+            }
+        }
+
+        int step(int state, char base) const {
+            int index = packedBaseCode(base);
+            return index < 0 ? 0 : this->transitions[state][index];
+        }
+
+        bool isEmpty() const {
+            return this->transitions.size() == 1;
+        }
+};
+
+
+// the incremental state of a sequence being checked against a set of
+// constraints, which is small enough to copy when trying alternative bases
+typedef struct {
+    int targetLength;
+    int length;
+    int gcInWindow;
+    int runLength;
+    char lastBase;
+    int motifState;
+} ConstraintState;
+
+
+// constraints on generated sequences: the GC content of every window of
+// gcWindow bases (or of the whole sequence, if gcWindow is zero), the longest
+// homopolymer run, and a set of forbidden motifs. Sequences are checked one
+// base at a time as they are generated, so that a candidate can be abandoned
+// as soon as it can no longer satisfy the constraints.
+class SequenceConstraints {
+    public:
+        double minGC = 0;
+        double maxGC = 1;
+        int gcWindow = 0;
+        int maxHomopolymer = 0;
+        MotifAutomaton motifs;
+
+        SequenceConstraints() {}
+
+        SequenceConstraints(
+            double minGC,
+            double maxGC,
+            int gcWindow,
+            int maxHomopolymer,
+            std::vector<std::string> forbiddenMotifs
+        ) {
+            this->minGC = minGC;
+            this->maxGC = maxGC;
+            this->gcWindow = gcWindow;
+            this->maxHomopolymer = maxHomopolymer;
+            this->motifs = MotifAutomaton(forbiddenMotifs);
+        }
+
+        bool isEnabled() const {
+            return this->minGC > 0 || this->maxGC < 1 || this->maxHomopolymer > 0 || !this->motifs.isEmpty();
+        }
+
+        ConstraintState start(int targetLength) const {
+            return {targetLength, 0, 0, 0, 0, 0};
+        }
+
+        // check whether base may be appended to sequence, which holds the bases
+        // accepted so far, updating the state if it may
+        bool extend(ConstraintState& state, const std::string& sequence, char base) const {
+            ConstraintState next = state;
+
+            // the homopolymer run
+            bool sameBase = packedBaseCode(base) == packedBaseCode(next.lastBase);
+            next.runLength = sameBase ? next.runLength + 1 : 1;
+            next.lastBase = base;
+            if (this->maxHomopolymer > 0 && next.runLength > this->maxHomopolymer) {
+                return false;
+            }
+
+            // the forbidden motifs
+            next.motifState = this->motifs.step(next.motifState, base);
+            if (this->motifs.accepting[next.motifState]) {
+                return false;
+            }
+
+            // the GC content of the current window, which must stay feasible
+            // while the first window is still being filled
+            int window = this->windowLength(next.targetLength);
+            next.gcInWindow += isGC(base);
+            next.length++;
+            if (next.length > window) {
+                next.gcInWindow -= isGC(sequence[next.length - 1 - window]);
+            }
+            int filled = std::min(next.length, window);
+            if (next.gcInWindow > this->maxGCCount(window) || next.gcInWindow + (window - filled) < this->minGCCount(window)) {
+                return false;
+            }
+
+            state = next;
+            return true;
+        }
+
+        // check a complete sequence from scratch
+        bool isSatisfiedBy(const std::string& sequence) const {
+            ConstraintState state = this->start(sequence.size());
+            for (int i = 0; i < sequence.size(); i++) {
+                if (!this->extend(state, sequence, sequence[i])) {
+                    return false;
+                }
+            }
+            return true;
+        }
+
+        // check the homopolymer run, the forbidden motifs and the GC windows
+        // that span the junction before position junction of an assembled
+        // sequence, whose parts were each generated or given on their own.
+        // With no GC window, the GC content only applies to each part.
+        bool isSatisfiedAcross(const std::string& sequence, int junction) const {
+            int size = sequence.size();
+            if (junction <= 0 || junction >= size) {
+                return true;
+            }
+
+            // the run of the bases either side of the junction
+            if (this->maxHomopolymer > 0 && packedBaseCode(sequence[junction - 1]) == packedBaseCode(sequence[junction])) {
+                int start = junction - 1;
+                while (start > 0 && packedBaseCode(sequence[start - 1]) == packedBaseCode(sequence[junction])) {
+                    start--;
+                }
+                int end = junction + 1;
+                while (end < size && packedBaseCode(sequence[end]) == packedBaseCode(sequence[junction])) {
+                    end++;
+                }
+                if (end - start > this->maxHomopolymer) {
+                    return false;
+                }
+            }
+
+            // the motifs that start before the junction and end after it
+            if (!this->motifs.isEmpty()) {
+                int state = 0;
+                int end = std::min(size, junction + this->motifs.maxLength - 1);
+                for (int i = std::max(0, junction - this->motifs.maxLength + 1); i < end; i++) {
+                    state = this->motifs.step(state, sequence[i]);
+                    if (i >= junction && this->motifs.longestMatch[state] > i - junction + 1) {
+                        return false;
+                    }
+                }
+            }
+
+            // the GC windows that hold the bases either side of the junction
+            if (this->gcWindow > 0 && size >= this->gcWindow) {
+                int window = this->gcWindow;
+                int first = std::max(0, junction - window + 1);
+                int last = std::min(junction - 1, size - window);
+                int gc = 0;
+                for (int i = first; i < first + window; i++) {
+                    gc += isGC(sequence[i]);
+                }
+                for (int start = first; start <= last; start++) {
+                    if (start > first) {
+                        gc += isGC(sequence[start + window - 1]) - isGC(sequence[start - 1]);
+                    }
+                    if (gc > this->maxGCCount(window) || gc < this->minGCCount(window)) {
+                        return false;
+                    }
+                }
+            }
+
+            return true;
+        }
+
+    private:
+        static int isGC(char base) {
+            return base == 'G' || base == 'C';
+        }
+
+        int windowLength(int targetLength) const {
+            return this->gcWindow > 0 ? std::min(this->gcWindow, targetLength) : targetLength;
+        }
+
+        // the bounds on the number of GC bases in a window are rounded
+        // outwards, so that the nearest achievable content is allowed in
+        // windows too short to hit the fractions exactly
+        int minGCCount(int window) const {
+            return (int) std::floor(this->minGC * window + 1e-9);
+        }
+
+        int maxGCCount(int window) const {
+            return (int) std::ceil(this->maxGC * window - 1e-9);
+        }
+};
@@ -0,0 +1,320 @@
+// demux.h
+
+#include <atomic>
+#include <cstdio>
+#include <cstring>
+#include <future>
+#include <string>
+#include <unordered_map>
+#include <vector>
+#ifdef FASTLIBRARYDESIGN_ZLIB
+#include <zlib.h>
+#endif
+
+
+// a reader of the sequence lines of a FASTQ file, which reads the file in
+// large blocks. If built with zlib, the file may also be gzipped.
+class FastqReader {
+    public:
+        FastqReader(std::string filename) {
+#ifdef FASTLIBRARYDESIGN_ZLIB
+            this->file = gzopen(filename.c_str(), "rb");
+            if (this->file != nullptr) {
+                gzbuffer(this->file, 1 << 20);
+            }
+#else
+            if (filename.size() > 3 && filename.substr(filename.size() - 3) == ".gz") {
+                std::cerr << "Error: " << filename << " is gzipped, but this build does not have zlib." << std::endl;
+                exit(EXIT_FAILURE);
+            }
+            this->file = fopen(filename.c_str(), "rb");
+#endif
+            if (this->file == nullptr) {
+                std::cerr << "Unable to open file: " << filename << std::endl;
+                exit(EXIT_FAILURE);
+            }
+            this->buffer.resize(1 << 20);
+        }
+
+        ~FastqReader() {
+#ifdef FASTLIBRARYDESIGN_ZLIB
+            gzclose(this->file);
+#else
+            fclose(this->file);
+#endif
+        }
+
+        // read the sequences of up to maxReads records into reads, reusing its
+        // strings, and return the number read
+        long long readBatch(std::vector<std::string>& reads, long long maxReads) {
+            if (reads.size() < maxReads) {
+                reads.resize(maxReads);
+            }
+            long long n = 0;
+            std::string line;
+            while (n < maxReads) {
+
+                // each record is a header, a sequence, a separator and qualities
+                if (!this->nextLine(line)) {
+                    break;
+                }
+                if (line.empty()) {
+                    continue;
+                }
+                if (!this->nextLine(reads[n])) {
+                    break;
+                }
+                this->nextLine(line);
+                this->nextLine(line);
+                n++;
+            }
+            return n;
+        }
+
+    private:
+#ifdef FASTLIBRARYDESIGN_ZLIB
+        gzFile file = nullptr;
+#else
+        FILE* file = nullptr;
+#endif
+        std::vector<char> buffer;
+        long long position = 0;
+        long long filled = 0;
+
+        bool fill() {
+#ifdef FASTLIBRARYDESIGN_ZLIB
+            int numRead = gzread(this->file, this->buffer.data(), this->buffer.size());
+#else
+            long long numRead = fread(this->buffer.data(), 1, this->buffer.size(), this->file);
+#endif
+            this->position = 0;
+            this->filled = std::max<long long>(0, numRead);
+            return this->filled > 0;
+        }
+
+        bool nextLine(std::string& line) {
+            line.clear();
+            while (true) {
+                if (this->position == this->filled && !this->fill()) {
+                    return !line.empty();
+                }
+                const char* start = this->buffer.data() + this->position;
+                const char* newline = (const char*) memchr(start, '\n', this->filled - this->position);
+                if (newline == nullptr) {
+                    line.append(start, this->filled - this->position);
+                    this->position = this->filled;
+                    continue;
+                }
+                line.append(start, newline - start);
+                this->position += newline - start + 1;
+                if (!line.empty() && line.back() == '\r') {
+                    line.pop_back();
+                }
+                return true;
+            }
+        }
+};
+
+
+// the outcome of assigning a single read to a design
+const int DEMUX_EXACT = 0;
+const int DEMUX_CORRECTED = 1;
+const int DEMUX_AMBIGUOUS = 2;
+const int DEMUX_UNASSIGNED = 3;
+
+
+// a barcode of up to 64 nt packed two bits per base, in two 64-bit words
+typedef unsigned __int128 DemuxKey;
+
+const int DEMUX_MAX_BARCODE_LENGTH = 64;
+
+struct DemuxKeyHash {
+    size_t operator()(DemuxKey key) const {
+        return packedHash((uint64_t) key ^ packedHash(key >> 64));
+    }
+};
+
+
+// assigns sequencing reads to the designs of a library by their barcodes.
+// Barcodes are packed two bits per base and looked up exactly; a read whose
+// barcode is not found is corrected if exactly one barcode is a single
+// substitution away from it, which the minimum Hamming distance of two between
+// designed barcodes makes the largest radius worth searching.
+class BarcodeDemultiplexer {
+    public:
+        std::vector<std::string> names;
+        std::vector<std::string> barcodes;
+        int barcodeLength = 0;
+
+        // the position of the barcode in each read, counted from the end of
+        // the read if negative
+        int offset = 0;
+
+        // load the names and barcodes of a library written by writeToCSV. By
+        // default, reads are expected to end with the barcode and the 3'
+        // constant region.
+        BarcodeDemultiplexer(std::string libraryFilename) {
+            std::ifstream file(libraryFilename);
+            if (!file.is_open()) {
+                std::cerr << "Unable to open file: " << libraryFilename << std::endl;
+                exit(EXIT_FAILURE);
+            }
+            std::string line;
+            std::getline(file, line);
+            int threePrimeLength = 0;
+            while (std::getline(file, line)) {
+                std::vector<std::string> tokens = splitByDelimiter(line, ',');
+                if (tokens.size() < 7 || tokens[5].empty() || tokens[5] == "N") {
+                    continue;
+                }
+                if (this->barcodeLength == 0) {
+                    this->barcodeLength = tokens[5].size();
+                    threePrimeLength = tokens[6].size();
+                }
+                if (tokens[5].size() != this->barcodeLength) {
+                    continue;
+                }
+                this->names.push_back(tokens[0]);
+                this->barcodes.push_back(tokens[5]);
+            }
+            if (this->barcodeLength > DEMUX_MAX_BARCODE_LENGTH) {
+                std::cerr << "Error: barcodes longer than " << DEMUX_MAX_BARCODE_LENGTH << " nt cannot be demultiplexed." << std::endl;
+                exit(EXIT_FAILURE);
+            }
+            this->offset = -(this->barcodeLength + threePrimeLength);
+
+            // index the packed barcodes, marking any that appear twice
+            this->index.reserve(2 * this->barcodes.size());
+            for (int i = 0; i < this->barcodes.size(); i++) {
+                DemuxKey packed;
+                if (this->pack(this->barcodes[i], 0, packed) != 0) {
+                    continue;
+                }
+                auto inserted = this->index.insert({packed, i});
+                if (!inserted.second) {
+                    inserted.first->second = -1;
+                }
+            }
+        }
+
+        // assign a read to a design, returning its index or -1, and setting
+        // the outcome of the assignment
+        int assign(const std::string& read, int& outcome) const {
+            int start = this->offset >= 0 ? this->offset : (int) read.size() + this->offset;
+            if (start < 0 || start + this->barcodeLength > read.size()) {
+                outcome = DEMUX_UNASSIGNED;
+                return -1;
+            }
+
+            // a barcode with one unreadable base is packed with an A in its place
+            DemuxKey packed;
+            int invalid = this->pack(read, start, packed);
+            if (invalid == 0) {
+                int design = this->lookup(packed);
+                if (design >= 0) {
+                    outcome = DEMUX_EXACT;
+                    return design;
+                }
+            }
+            if (invalid > 1) {
+                outcome = DEMUX_UNASSIGNED;
+                return -1;
+            }
+
+            // try every single substitution, or only those at the unreadable base
+            int match = -1;
+            int numMatches = 0;
+            for (int i = 0; i < this->barcodeLength; i++) {
+                if (invalid == 1 && packedBaseCode(read[start + i]) >= 0) {
+                    continue;
+                }
+                int shift = 2 * (this->barcodeLength - 1 - i);
+                int code = (packed >> shift) & 3;
+                for (int substitute = 0; substitute < 4; substitute++) {
+                    if (substitute == code && invalid == 0) {
+                        continue;
+                    }
+                    int design = this->lookup((packed & ~((DemuxKey) 3 << shift)) | ((DemuxKey) substitute << shift));
+                    if (design >= 0 && design != match) {
+                        match = design;
+                        numMatches++;
+                    }
+                }
+            }
+            if (numMatches == 1) {
+                outcome = DEMUX_CORRECTED;
+                return match;
+            }
+            outcome = numMatches > 1 ? DEMUX_AMBIGUOUS : DEMUX_UNASSIGNED;
+            return -1;
+        }
+
+        // count the reads of a FASTQ file assigned to each design, processing
+        // batches of reads in parallel while the next batch is read, and
+        // return the number of reads
+        long long run(std::string fastqFilename, std::string countsFilename) {
+            const long long batchSize = 1 << 18;
+            std::vector<std::atomic<long long> > counts(this->barcodes.size());
+            std::atomic<long long> outcomes[4] = {{0}, {0}, {0}, {0}};
+
+            FastqReader reader(fastqFilename);
+            std::vector<std::string> batches[2];
+            long long numReads = reader.readBatch(batches[0], batchSize);
+            long long totalReads = 0;
+            for (int current = 0; numReads > 0; current = 1 - current) {
+                std::future<long long> next = std::async(std::launch::async, [&, current]() {
+                    return reader.readBatch(batches[1 - current], batchSize);
+                });
+
+                const std::vector<std::string>& reads = batches[current];
+                parallelFor(numReads, [&](long long begin, long long end, int thread) {
+                    long long localOutcomes[4] = {0, 0, 0, 0};
+                    for (long long i = begin; i < end; i++) {
+                        int outcome;
+                        int design = this->assign(reads[i], outcome);
+                        if (design >= 0) {
+                            counts[design].fetch_add(1, std::memory_order_relaxed);
+                        }
+                        localOutcomes[outcome]++;
+                    }
+                    for (int outcome = 0; outcome < 4; outcome++) {
+                        outcomes[outcome].fetch_add(localOutcomes[outcome], std::memory_order_relaxed);
+                    }
+                });
+
+                totalReads += numReads;
+                numReads = next.get();
+            }
+
+            std::cout << "Demultiplexed " << totalReads << " reads: " << outcomes[DEMUX_EXACT].load() << " exact, " << outcomes[DEMUX_CORRECTED].load() << " corrected, " << outcomes[DEMUX_AMBIGUOUS].load() << " ambiguous and " << outcomes[DEMUX_UNASSIGNED].load() << " unassigned." << std::endl;
+
+            std::ofstream file(countsFilename);
+            file << "Name,Barcode,Count\n";
+            for (int i = 0; i < this->barcodes.size(); i++) {
+                file << this->names[i] << "," << this->barcodes[i] << "," << counts[i].load() << "\n";
+            }
+            file.close();
+            return totalReads;
+        }
+
+    private:
+        std::unordered_map<DemuxKey, int, DemuxKeyHash> index;
+
+        // pack the barcode of a read that starts at start, returning the
+        // number of bases other than A, C, G, U or T, which are packed as A
+        int pack(const std::string& sequence, int start, DemuxKey& packed) const {
+            packed = 0;
+            int invalid = 0;
+            for (int i = 0; i < this->barcodeLength; i++) {
+                int8_t code = packedBaseCode(sequence[start + i]);
+                invalid += code < 0;
+                packed = (packed << 2) | (code < 0 ? 0 : code);
+            }
+            return invalid;
+        }
+
+        int lookup(DemuxKey packed) const {
+            auto found = this->index.find(packed);
+            return found == this->index.end() ? -1 : found->second;
+        }
+};
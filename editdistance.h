@@ -0,0 +1,231 @@
+// editdistance.h
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+
+// the Levenshtein distance between two sequences by dynamic programming, for
+// sequences too long for the bit-parallel kernel
+int editDistanceByDynamicProgramming(const std::string& a, const std::string& b) {
+    std::vector<int> row(b.size() + 1);
+    for (int j = 0; j <= b.size(); j++) {
+        row[j] = j;
+    }
+    for (int i = 1; i <= a.size(); i++) {
+        int diagonal = row[0];
+        row[0] = i;
+        for (int j = 1; j <= b.size(); j++) {
+            int above = row[j];
+            row[j] = std::min({row[j] + 1, row[j - 1] + 1, diagonal + (a[i - 1] != b[j - 1])});
+            diagonal = above;
+        }
+    }
+    return row[b.size()];
+}
+
+
+// check whether the Levenshtein distance between two sequences is at most
+// maxDistance. The shorter sequence is held as a bit vector of at most 64
+// bases, and the dynamic programming matrix is advanced a whole column per
+// base of the longer sequence (Myers 1999, in the formulation of Hyyrö 2001).
+// The scan stops as soon as the distance can no longer come within the bound.
+bool isWithinEditDistance(const char* a, int lengthA, const char* b, int lengthB, int maxDistance) {
+    const char* pattern = lengthA <= lengthB ? a : b;
+    const char* text = lengthA <= lengthB ? b : a;
+    int m = std::min(lengthA, lengthB);
+    int n = std::max(lengthA, lengthB);
+    if (n - m > maxDistance) {
+        return false;
+    }
+    if (m == 0) {
+        return n <= maxDistance;
+    }
+    if (m > 64) {
+        return editDistanceByDynamicProgramming(std::string(a, lengthA), std::string(b, lengthB)) <= maxDistance;
+    }
+
+    // the positions of each base in the pattern, keyed by the low five bits
+    // of the base, which are distinct for A, C, G, U, T and N
+    uint64_t peq[32] = {0};
+    for (int i = 0; i < m; i++) {
+        peq[pattern[i] & 31] |= 1ULL << i;
+    }
+
+    uint64_t last = 1ULL << (m - 1);
+    uint64_t pv = m == 64 ? ~0ULL : (1ULL << m) - 1;
+    uint64_t mv = 0;
+    int score = m;
+    for (int j = 0; j < n; j++) {
+        uint64_t eq = peq[text[j] & 31];
+        uint64_t xv = eq | mv;
+        uint64_t xh = (((eq & pv) + pv) ^ pv) | eq;
+        uint64_t ph = mv | ~(xh | pv);
+        uint64_t mh = pv & xh;
+        score += ((ph & last) != 0) - ((mh & last) != 0);
+
+        // every column of the first row is one more than the last
+        ph = (ph << 1) | 1;
+        mh = mh << 1;
+        pv = mh | ~(xv | ph);
+        mv = ph & xv;
+
+        // the score can fall by at most one per remaining column
+        if (score - (n - 1 - j) > maxDistance) {
+            return false;
+        }
+    }
+    return score <= maxDistance;
+}
+
+bool isWithinEditDistance(const std::string& a, const std::string& b, int maxDistance) {
+    return isWithinEditDistance(a.data(), a.size(), b.data(), b.size(), maxDistance);
+}
+
+
+// an index of sequences that answers whether a query is within a Levenshtein
+// distance of any of them. maxDistance + 1 disjoint pieces are taken from the
+// entries of the indexed length; a query within the distance must contain one
+// of the pieces of the entry unchanged, shifted by at most maxDistance, so
+// only the entries with a matching piece are verified with the bit-parallel
+// kernel. Pieces are not taken from the excluded range, which is for bases
+// that every entry shares, such as a barcode loop, since a piece there would
+// match every entry. Entries of any other length are few, and are compared
+// directly.
+class EditDistanceIndex {
+    public:
+        int length = 0;
+        int maxDistance = -1;
+
+        EditDistanceIndex() {}
+
+        EditDistanceIndex(int length, int maxDistance, int excludedStart = 0, int excludedEnd = 0) {
+            this->length = length;
+            this->maxDistance = maxDistance;
+
+            // share the pieces between the bases either side of the excluded
+            // range in proportion to their lengths
+            int numPieces = std::max(1, std::min(maxDistance + 1, length - (excludedEnd - excludedStart)));
+            int leftLength = excludedStart;
+            int rightLength = length - excludedEnd;
+            int leftPieces = (int) std::lround((double) numPieces * leftLength / std::max(1, leftLength + rightLength));
+            leftPieces = std::min(leftPieces, leftLength);
+            int rightPieces = std::min(numPieces - leftPieces, rightLength);
+            leftPieces = numPieces - rightPieces;
+            for (int piece = 0; piece < leftPieces; piece++) {
+                this->pieceStarts.push_back(piece * leftLength / leftPieces);
+                this->pieceEnds.push_back((piece + 1) * leftLength / leftPieces);
+            }
+            for (int piece = 0; piece < rightPieces; piece++) {
+                this->pieceStarts.push_back(excludedEnd + piece * rightLength / rightPieces);
+                this->pieceEnds.push_back(excludedEnd + (piece + 1) * rightLength / rightPieces);
+            }
+            this->pieces.resize(numPieces);
+        }
+
+        bool isEnabled() const {
+            return this->maxDistance >= 0;
+        }
+
+        void insert(const std::string& sequence) {
+            std::string entry = ::toRNA(sequence);
+            if (entry.size() != this->length) {
+                this->irregular.push_back(entry);
+                return;
+            }
+            int id = this->removed.size();
+            this->entries += entry;
+            this->removed.push_back(false);
+            this->stamps.push_back(0);
+            for (int piece = 0; piece < this->pieces.size(); piece++) {
+                this->pieces[piece][this->pieceKey(entry, piece)].push_back(id);
+            }
+        }
+
+        // remove a sequence from the index. The entry is only marked as
+        // removed, since removals are rare
+        void erase(const std::string& sequence) {
+            std::string entry = ::toRNA(sequence);
+            if (entry.size() != this->length) {
+                for (std::string& existing : this->irregular) {
+                    if (existing == entry) {
+                        existing.clear();
+                    }
+                }
+                return;
+            }
+            for (int id : this->pieces[0][this->pieceKey(entry, 0)]) {
+                if (this->entries.compare(id * this->length, this->length, entry) == 0) {
+                    this->removed[id] = true;
+                }
+            }
+        }
+
+        // check whether the sequence is within the distance of any entry
+        bool containsNeighbourOf(const std::string& sequence) const {
+            std::string query = ::toRNA(sequence);
+            long long probes = 0;
+            bool found = this->findNeighbour(query, probes);
+            METRICS.indexProbes.fetch_add(probes, std::memory_order_relaxed);
+            return found;
+        }
+
+    private:
+        // the entries of the indexed length, stored back to back
+        std::string entries;
+        std::vector<bool> removed;
+        std::vector<std::string> irregular;
+
+        std::vector<int> pieceStarts;
+        std::vector<int> pieceEnds;
+        std::vector<std::unordered_map<uint64_t, std::vector<int> > > pieces;
+
+        // the query each entry was last verified against, so that queries
+        // from a single thread verify each entry at most once
+        mutable std::vector<unsigned int> stamps;
+        mutable unsigned int stamp = 0;
+
+        uint64_t pieceKey(const std::string& sequence, int piece) const {
+            return packedSubstringKey(sequence, this->pieceStarts[piece], this->pieceEnds[piece] - this->pieceStarts[piece]);
+        }
+
+        bool findNeighbour(const std::string& query, long long& probes) const {
+            for (const std::string& entry : this->irregular) {
+                probes++;
+                if (!entry.empty() && isWithinEditDistance(entry, query, this->maxDistance)) {
+                    return true;
+                }
+            }
+
+            // look up every piece at every shift that keeps it within the
+            // query, verifying each entry at most once
+            this->stamp++;
+            for (int piece = 0; piece < this->pieces.size(); piece++) {
+                int pieceLength = this->pieceEnds[piece] - this->pieceStarts[piece];
+                for (int shift = -this->maxDistance; shift <= this->maxDistance; shift++) {
+                    int start = this->pieceStarts[piece] + shift;
+                    if (start < 0 || start + pieceLength > query.size()) {
+                        continue;
+                    }
+                    auto candidates = this->pieces[piece].find(packedSubstringKey(query, start, pieceLength));
+                    if (candidates == this->pieces[piece].end()) {
+                        continue;
+                    }
+                    for (int id : candidates->second) {
+                        if (this->stamps[id] == this->stamp || this->removed[id]) {
+                            continue;
+                        }
+                        this->stamps[id] = this->stamp;
+                        probes++;
+                        if (isWithinEditDistance(this->entries.data() + (long long) id * this->length, this->length, query.data(), query.size(), this->maxDistance)) {
+                            return true;
+                        }
+                    }
+                }
+            }
+            return false;
+        }
+};
@@ -22,7 +22,7 @@ std::string strip(std::string s) {
 
 bool validateNucleicSequence(std::string sequence) {
     for (char base : sequence) {
-        if (NUCLEIC_BASES.find(std::string(1, base)) == NUCLEIC_BASES.end()) {
+        if (!isNucleicBase(base)) {
             return false;
         }
     }
@@ -65,6 +65,11 @@ class FastaFile {
     public:
         std::vector<FastaRecord> records;
 
+        // the sequences at two bits per base, when they have been packed, in
+        // which case the sequence of each record is left empty
+        std::vector<PackedSequence> packedSequences;
+        bool isPacked = false;
+
         // create an empty FastaFile
         FastaFile() {
             this->records = {};
@@ -143,68 +148,165 @@ class FastaFile {
 
         void write(std::string filename) {
             std::ofstream file(filename);
-            for (FastaRecord record : this->records) {
-                file << record.header << std::endl;
-                file << record.sequence << std::endl;
+            std::string sequence;
+            for (int i = 0; i < this->records.size(); i++) {
+                file << this->records[i].header << std::endl;
+                file << this->sequenceOf(i, sequence) << std::endl;
             }
         }
 
         void push_back(FastaRecord record) {
+            if (this->isPacked) {
+                this->packedSequences.push_back(PackedSequence(record.sequence));
+                record.sequence = "";
+            }
             this->records.push_back(record);
         }
 
+        // store the sequences at two bits per base, freeing their strings
+        void pack() {
+            if (this->isPacked) {
+                return;
+            }
+            this->packedSequences.resize(this->records.size());
+            parallelFor(this->records.size(), [&](long long begin, long long end, int thread) {
+                for (long long i = begin; i < end; i++) {
+                    this->packedSequences[i] = PackedSequence(this->records[i].sequence);
+                    std::string().swap(this->records[i].sequence);
+                }
+            });
+            this->isPacked = true;
+        }
+
+        void unpack() {
+            if (!this->isPacked) {
+                return;
+            }
+            parallelFor(this->records.size(), [&](long long begin, long long end, int thread) {
+                for (long long i = begin; i < end; i++) {
+                    this->records[i].sequence = this->packedSequences[i].toString();
+                }
+            });
+            std::vector<PackedSequence>().swap(this->packedSequences);
+            this->isPacked = false;
+        }
+
+        int sequenceLength(int i) {
+            return this->isPacked ? this->packedSequences[i].size() : this->records[i].sequence.size();
+        }
+
+        // the sequence of a record, decoded into scratch if it is packed
+        const std::string& sequenceOf(int i, std::string& scratch) {
+            if (!this->isPacked) {
+                return this->records[i].sequence;
+            }
+            scratch.clear();
+            this->packedSequences[i].appendTo(scratch);
+            return scratch;
+        }
+
         void concatenate(FastaFile fastaFile) {
-            for (FastaRecord record : fastaFile) {
-                this->push_back(record);
+            for (int i = 0; i < fastaFile.size(); i++) {
+                this->push_back(fastaFile[i]);
             }
         }
 
         // attach a sequence to the 5' end of each record
         void attachToFivePrimeRegion(std::string sequence) {
-            for (FastaRecord &record : this->records) {
-                record.sequence = sequence + record.sequence;
-            }
+            parallelFor(this->records.size(), [&](long long begin, long long end, int thread) {
+                for (long long i = begin; i < end; i++) {
+                    FastaRecord& record = this->records[i];
+                    if (this->isPacked) {
+                        this->packedSequences[i] = PackedSequence(sequence + this->packedSequences[i].toString());
+                        continue;
+                    }
+                    record.sequence = sequence + record.sequence;
+                }
+            });
         }
 
         // attach a sequence to the 3' end of each record
         void attachToThreePrimeRegion(std::string sequence) {
-            for (FastaRecord &record : this->records) {
-                record.sequence = record.sequence + sequence;
-            }
+            parallelFor(this->records.size(), [&](long long begin, long long end, int thread) {
+                for (long long i = begin; i < end; i++) {
+                    FastaRecord& record = this->records[i];
+                    if (this->isPacked) {
+                        this->packedSequences[i] = PackedSequence(this->packedSequences[i].toString() + sequence);
+                        continue;
+                    }
+                    record.sequence = record.sequence + sequence;
+                }
+            });
         }
 
         // convert all sequences to RNA
         void toRNA() {
-            for (FastaRecord &record : this->records) {
-                record.sequence = ::toRNA(record.sequence);
-            }
+            parallelFor(this->records.size(), [&](long long begin, long long end, int thread) {
+                for (long long i = begin; i < end; i++) {
+                    FastaRecord& record = this->records[i];
+                    if (this->isPacked) {
+                        this->packedSequences[i].toRNA();
+                        continue;
+                    }
+                    record.sequence = ::toRNA(record.sequence);
+                }
+            });
         }
 
         // convert all sequences to DNA
         void toDNA() {
-            for (FastaRecord &record : this->records) {
-                record.sequence = ::toDNA(record.sequence);
-            }
+            parallelFor(this->records.size(), [&](long long begin, long long end, int thread) {
+                for (long long i = begin; i < end; i++) {
+                    FastaRecord& record = this->records[i];
+                    if (this->isPacked) {
+                        this->packedSequences[i].toDNA();
+                        continue;
+                    }
+                    record.sequence = ::toDNA(record.sequence);
+                }
+            });
         }
 
-        // get the unique lengths of the sequences in the file
+        // get the unique lengths of the sequences in the file, in order
         std::vector<int> getUniqueLengths() {
             std::vector<int> lengths;
-            for (FastaRecord record : this->records) {
-                int length = record.sequence.size();
-                if (std::find(lengths.begin(), lengths.end(), length) == lengths.end()) {
-                    lengths.push_back(length);
-                }
+            lengths.reserve(this->records.size());
+            for (int i = 0; i < this->records.size(); i++) {
+                lengths.push_back(this->sequenceLength(i));
             }
-
-            // sort the lengths
             std::sort(lengths.begin(), lengths.end());
+            lengths.erase(std::unique(lengths.begin(), lengths.end()), lengths.end());
 
             return lengths;
         }
 
-        // remove duplicate sequences from the file
+        // compute the statistics of the sequences in a single parallel pass
+        SequenceStatistics statistics() {
+            return computeStatistics(this->records.size(), {"sequence"}, -1, 0, [&](long long i, std::vector<const std::string*>& regions) {
+                thread_local std::string scratch;
+                regions.push_back(&this->sequenceOf(i, scratch));
+            });
+        }
+
+        // remove duplicate sequences from the file, comparing packed
+        // sequences without decoding them
         int removeDuplicates() {
+            if (this->isPacked) {
+                std::unordered_set<PackedSequence, PackedSequenceHash> uniqueSequences;
+                std::vector<FastaRecord> uniqueRecords;
+                std::vector<PackedSequence> uniquePackedSequences;
+                for (int i = 0; i < this->records.size(); i++) {
+                    if (uniqueSequences.insert(this->packedSequences[i]).second) {
+                        uniqueRecords.push_back(this->records[i]);
+                        uniquePackedSequences.push_back(this->packedSequences[i]);
+                    }
+                }
+                int numDuplicates = this->records.size() - uniqueRecords.size();
+                this->records = uniqueRecords;
+                this->packedSequences = uniquePackedSequences;
+                return numDuplicates;
+            }
+
             std::unordered_set<std::string> uniqueSequences;
             std::vector<FastaRecord> uniqueRecords;
             for (FastaRecord record : this->records) {
@@ -237,7 +339,11 @@ class FastaFile {
         }
 
         FastaRecord operator[](int i) {
-            return this->records[i];
+            FastaRecord record = this->records[i];
+            if (this->isPacked) {
+                record.sequence = this->packedSequences[i].toString();
+            }
+            return record;
         }
 
 };
\ No newline at end of file
@@ -0,0 +1,286 @@
+// fold.h
+
+#include <string>
+#include <vector>
+#include <cmath>
+#include <algorithm>
+
+
+// a compact nearest-neighbour folding model, used to check that designed
+// stems fold into their intended hairpins. Energies are in units of
+// 0.1 kcal/mol. Only hairpins, stacks, bulges and interior loops are
+// modelled; multiloops are not, since the windows that are checked are short.
+
+// the pair types, in the order of the stacking table
+const int FOLD_NO_PAIR = -1;
+const int FOLD_PAIR_TYPES[4][4] = {
+    // A   C   G   U
+    {-1, -1, -1,  4}, // A
+    {-1, -1,  0, -1}, // C
+    {-1,  1, -1,  2}, // G
+    { 5, -1,  3, -1}  // U
+};
+
+// stacking energies of the pair (i, j) on the pair (j - 1, i + 1), for the
+// pair types CG, GC, GU, UG, AU, UA (Turner 2004)
+const int FOLD_STACK[6][6] = {
+    {-24, -33, -21, -14, -21, -21},
+    {-33, -34, -25, -15, -22, -24},
+    {-21, -25,  13,  -5, -14, -13},
+    {-14, -15,  -5,   3,  -6, -10},
+    {-21, -22, -14,  -6, -11,  -9},
+    {-21, -24, -13, -10,  -9, -13}
+};
+
+// loop initiation energies, indexed by the number of unpaired bases
+const int FOLD_HAIRPIN[10] = {999, 999, 999, 54, 56, 57, 54, 60, 55, 64};
+const int FOLD_BULGE[7] = {0, 38, 28, 32, 36, 40, 44};
+const int FOLD_INTERIOR[7] = {0, 0, 5, 16, 11, 20, 20};
+const int FOLD_INTERIOR_ASYMMETRY = 6;
+const int FOLD_TERMINAL_PENALTY = 5;
+const int FOLD_MAX_LOOP = 6;
+const int FOLD_MIN_HAIRPIN = 3;
+const int FOLD_INF = 1 << 28;
+
+// the constraints that may be placed on a base when folding
+const int FOLD_FREE = -1;
+const int FOLD_UNPAIRED = -2;
+
+
+int foldHairpinEnergy(int unpaired) {
+    if (unpaired < 10) {
+        return FOLD_HAIRPIN[unpaired];
+    }
+    return FOLD_HAIRPIN[9] + (int) std::lround(10.78 * std::log(unpaired / 9.0));
+}
+
+
+class HairpinFolder {
+    public:
+
+        // the minimum free energy of the sequence between start and end, over
+        // all secondary structures without multiloops. If partners is given,
+        // it constrains each base of the sequence: FOLD_FREE bases may pair
+        // with any base, FOLD_UNPAIRED bases may not pair, and the remaining
+        // bases may only pair with the base at the given offset from start.
+        int minimumFreeEnergy(
+            const std::string& sequence,
+            int start,
+            int end,
+            const std::vector<int>* partners = nullptr
+            ) {
+            int n = end - start;
+            if (n <= 0) {
+                return 0;
+            }
+            this->load(sequence, start, n, partners);
+
+            // tabulate the pair type of every pair of bases once, so that the
+            // recursions below are plain table lookups
+            this->types.resize(n * n);
+            for (int i = 0; i < n; i++) {
+                for (int j = 0; j < n; j++) {
+                    this->types[i * n + j] = this->pairType(i, j);
+                }
+            }
+            if (this->hairpins.size() < n) {
+                for (int unpaired = this->hairpins.size(); unpaired < n; unpaired++) {
+                    this->hairpins.push_back(foldHairpinEnergy(unpaired));
+                }
+            }
+
+            // fill the table of energies of substructures closed by a pair,
+            // working outwards from the shortest spans
+            this->closed.assign(n * n, FOLD_INF);
+            for (int span = FOLD_MIN_HAIRPIN + 1; span < n; span++) {
+                for (int i = 0; i + span < n; i++) {
+                    int j = i + span;
+                    int type = this->types[i * n + j];
+                    if (type == FOLD_NO_PAIR) {
+                        continue;
+                    }
+
+                    // the pair may close a hairpin
+                    int best = this->hairpins[j - i - 1];
+
+                    // or it may close a stack, bulge or interior loop
+                    for (int left = 0; left <= FOLD_MAX_LOOP; left++) {
+                        for (int right = 0; left + right <= FOLD_MAX_LOOP; right++) {
+                            int k = i + 1 + left;
+                            int l = j - 1 - right;
+                            if (l - k <= FOLD_MIN_HAIRPIN) {
+                                break;
+                            }
+                            int inner = this->closed[k * n + l];
+                            if (inner == FOLD_INF) {
+                                continue;
+                            }
+                            best = std::min(best, inner + this->loopEnergy(type, this->types[l * n + k], left, right));
+                        }
+                    }
+                    this->closed[i * n + j] = best;
+                }
+            }
+
+            // the exterior loop is a sequence of independent closed structures
+            this->exterior.assign(n + 1, 0);
+            for (int j = 1; j <= n; j++) {
+                int best = this->exterior[j - 1];
+                for (int i = 0; i + FOLD_MIN_HAIRPIN + 1 < j; i++) {
+                    int inner = this->closed[i * n + j - 1];
+                    if (inner != FOLD_INF) {
+                        best = std::min(best, this->exterior[i] + inner + (this->types[i * n + j - 1] >= 2 ? FOLD_TERMINAL_PENALTY : 0));
+                    }
+                }
+                this->exterior[j] = best;
+            }
+
+            return this->exterior[n];
+        }
+
+
+        // the energy of the perfect hairpin whose stem of the given length
+        // starts at start, including the terminal penalty of its outer pair
+        int hairpinEnergy(const std::string& sequence, int start, int stemLength, int loopLength) {
+            int n = 2 * stemLength + loopLength;
+            if (stemLength == 0) {
+                return FOLD_INF;
+            }
+            this->load(sequence, start, n);
+
+            int energy = foldHairpinEnergy(loopLength) + this->terminalPenalty(0, n - 1);
+            for (int k = 0; k < stemLength; k++) {
+                int type = this->pairType(k, n - 1 - k);
+                if (type == FOLD_NO_PAIR) {
+                    return FOLD_INF;
+                }
+                if (k + 1 < stemLength) {
+                    energy += this->loopEnergy(type, this->pairType(n - 2 - k, k + 1), 0, 0);
+                }
+            }
+            return energy;
+        }
+
+
+        // check that the hairpin whose stem starts at start folds as intended
+        // within a window of context bases on either side. The hairpin folds as
+        // intended if no structure of the window is more stable, by more than
+        // the given margin, than the best structure in which the bases of the
+        // hairpin pair only with their intended partners.
+        bool foldsAsIntended(
+            const std::string& sequence,
+            int start,
+            int stemLength,
+            int loopLength,
+            int context,
+            int margin = 0
+            ) {
+            int end = start + 2 * stemLength + loopLength;
+            int windowStart = std::max(0, start - context);
+            int windowEnd = std::min((int) sequence.size(), end + context);
+            if (this->hairpinEnergy(sequence, start, stemLength, loopLength) == FOLD_INF) {
+                return false;
+            }
+
+            // constrain the stem to its intended pairs, and the loop to be unpaired
+            this->partners.assign(windowEnd - windowStart, FOLD_FREE);
+            for (int k = 0; k < stemLength; k++) {
+                int i = start - windowStart + k;
+                int j = end - windowStart - 1 - k;
+                this->partners[i] = j;
+                this->partners[j] = i;
+            }
+            for (int k = start + stemLength; k < end - stemLength; k++) {
+                this->partners[k - windowStart] = FOLD_UNPAIRED;
+            }
+
+            int constrained = this->minimumFreeEnergy(sequence, windowStart, windowEnd, &this->partners);
+            return this->minimumFreeEnergy(sequence, windowStart, windowEnd) + margin >= constrained;
+        }
+
+    private:
+        std::vector<int> bases;
+        std::vector<int> types;
+        std::vector<int> hairpins;
+        std::vector<int> closed;
+        std::vector<int> exterior;
+
+        std::vector<int> partners;
+        const std::vector<int>* constraints = nullptr;
+
+        void load(const std::string& sequence, int start, int n, const std::vector<int>* constraints = nullptr) {
+            this->bases.resize(n);
+            for (int i = 0; i < n; i++) {
+                this->bases[i] = packedBaseCode(sequence[start + i]);
+            }
+            this->constraints = constraints;
+        }
+
+        int pairType(int i, int j) {
+            if (this->bases[i] < 0 || this->bases[j] < 0) {
+                return FOLD_NO_PAIR;
+            }
+            if (this->constraints != nullptr) {
+                int partnerOfI = (*this->constraints)[i];
+                int partnerOfJ = (*this->constraints)[j];
+                if ((partnerOfI != FOLD_FREE && partnerOfI != j) || (partnerOfJ != FOLD_FREE && partnerOfJ != i)) {
+                    return FOLD_NO_PAIR;
+                }
+            }
+            return FOLD_PAIR_TYPES[this->bases[i]][this->bases[j]];
+        }
+
+        int terminalPenalty(int i, int j) {
+            // every pair other than GC and CG ends in an A or a U
+            int type = this->pairType(i, j);
+            return type >= 2 ? FOLD_TERMINAL_PENALTY : 0;
+        }
+
+        int loopEnergy(int outer, int inner, int left, int right) {
+            if (outer == FOLD_NO_PAIR || inner == FOLD_NO_PAIR) {
+                return FOLD_INF;
+            }
+            if (left == 0 && right == 0) {
+                return FOLD_STACK[outer][inner];
+            }
+            if (left == 0 || right == 0) {
+                int size = left + right;
+                return FOLD_BULGE[size] + (size == 1 ? FOLD_STACK[outer][inner] : 0);
+            }
+            return FOLD_INTERIOR[left + right] + FOLD_INTERIOR_ASYMMETRY * std::abs(left - right);
+        }
+};
+
+
+// the shortest padding stem that is expected to fold on its own, and so the
+// shortest that is checked
+const int FOLD_MIN_CHECKED_STEM = 4;
+
+
+// check every stem of a stretch of padding generated by getPadding, which
+// starts at start within the full sequence
+bool paddingFoldsAsIntended(
+    HairpinFolder& folder,
+    const std::string& sequence,
+    int start,
+    int paddingLength,
+    int minStemLength,
+    int maxStemLength,
+    int loopLength,
+    int context
+    ) {
+    for (int segment : getPaddingPlan(paddingLength, minStemLength, maxStemLength, loopLength)) {
+        if (segment < 0) {
+            start -= segment;
+            continue;
+        }
+        if (segment >= FOLD_MIN_CHECKED_STEM) {
+            METRICS.foldChecks.fetch_add(1, std::memory_order_relaxed);
+            if (!folder.foldsAsIntended(sequence, start, segment, loopLength, context)) {
+                return false;
+            }
+        }
+        start += 2 * segment + loopLength;
+    }
+    return true;
+}
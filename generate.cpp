@@ -0,0 +1,118 @@
+// generate.cpp
+
+#include <argparse/argparse.hpp>
+#include "synthetic.h"
+#include <sstream>
+
+using std::string;
+
+
+// parse a comma separated list of lengths, each optionally followed by a colon
+// and a relative weight, e.g. "40:1,60:2,80"
+void parseLengthDistribution(
+    std::string specification,
+    std::vector<int>& lengths,
+    std::vector<double>& weights
+    ) {
+    std::stringstream stream(specification);
+    std::string token;
+    while (std::getline(stream, token, ',')) {
+        if (token.empty()) {
+            continue;
+        }
+        size_t colon = token.find(':');
+        lengths.push_back(std::stoi(token.substr(0, colon)));
+        weights.push_back(colon == std::string::npos ? 1.0 : std::stod(token.substr(colon + 1)));
+    }
+}
+
+
+int main(int argc, char** argv) {
+
+	argparse::ArgumentParser program("fastLibraryGenerate");
+
+	program.add_argument("output");
+
+	program.add_argument("--rows")
+		.default_value(1000000LL)
+		.scan<'d', long long>();
+
+	program.add_argument("--lengths")
+		.default_value("40,60,80");
+
+	program.add_argument("--barcoded")
+		.default_value(0.0)
+		.scan<'g', double>();
+	program.add_argument("--nullBarcodes")
+		.default_value(0.0)
+		.scan<'g', double>();
+	program.add_argument("--duplicateDesigns")
+		.default_value(0.0)
+		.scan<'g', double>();
+	program.add_argument("--duplicateBarcodes")
+		.default_value(0.0)
+		.scan<'g', double>();
+
+	program.add_argument("--barcodeLength")
+		.default_value(13)
+		.scan<'d', int>();
+	program.add_argument("--barcodeStemLoop")
+		.default_value("UUCG");
+
+	program.add_argument("--seed")
+		.default_value(42LL)
+		.scan<'d', long long>();
+
+	try {
+	  program.parse_args(argc, argv);
+	}
+	catch (const std::exception& err) {
+	  std::cerr << err.what() << std::endl;
+	  std::cerr << program;
+	  std::exit(1);
+	}
+
+	string output = program.get<string>("output");
+
+    SyntheticLibraryConfig config = defaultSyntheticLibraryConfig();
+    config.numRows = program.get<long long>("--rows");
+    config.designLengths = {};
+    config.designLengthWeights = {};
+    parseLengthDistribution(program.get<string>("--lengths"), config.designLengths, config.designLengthWeights);
+    config.fractionBarcoded = program.get<double>("--barcoded");
+    config.fractionNullBarcode = program.get<double>("--nullBarcodes");
+    config.fractionDuplicateDesign = program.get<double>("--duplicateDesigns");
+    config.fractionDuplicateBarcode = program.get<double>("--duplicateBarcodes");
+    config.barcodeLength = program.get<int>("--barcodeLength");
+    config.barcodeStemLoop = program.get<string>("--barcodeStemLoop");
+    config.seed = program.get<long long>("--seed");
+
+    if (config.designLengths.empty()) {
+        std::cerr << "Error: no design lengths were given." << std::endl;
+        exit(EXIT_FAILURE);
+    }
+
+    if (config.fractionBarcoded + config.fractionNullBarcode > 1) {
+        std::cerr << "Error: the barcoded and null barcode fractions sum to more than one." << std::endl;
+        exit(EXIT_FAILURE);
+    }
+
+    // stream the library to stdout, or to a file through a large buffer
+    if (output == "-") {
+        std::ios::sync_with_stdio(false);
+        writeSyntheticLibraryCSV(std::cout, config);
+        return 0;
+    }
+
+    std::vector<char> buffer(1 << 20);
+    std::ofstream file;
+    file.rdbuf()->pubsetbuf(buffer.data(), buffer.size());
+    file.open(output);
+    if (!file.is_open()) {
+        std::cerr << "Unable to open file: " << output << std::endl;
+        exit(EXIT_FAILURE);
+    }
+    writeSyntheticLibraryCSV(file, config);
+
+    return 0;
+}
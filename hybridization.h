@@ -0,0 +1,203 @@
+// hybridization.h
+
+#include <cstdint>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+
+// the reverse complement of a sequence, as RNA
+std::string reverseComplement(const std::string& sequence) {
+    std::string complement(sequence.size(), 'N');
+    for (int i = 0; i < sequence.size(); i++) {
+        switch (sequence[sequence.size() - 1 - i]) {
+            case 'A': complement[i] = 'U'; break;
+            case 'C': complement[i] = 'G'; break;
+            case 'G': complement[i] = 'C'; break;
+            case 'U': complement[i] = 'A'; break;
+            case 'T': complement[i] = 'A'; break;
+        }
+    }
+    return complement;
+}
+
+
+// an index of sequences of a single length, which answers whether a query is
+// within a Hamming radius of any of them. By the pigeonhole principle, two
+// sequences within the radius agree exactly on at least one of radius + 1
+// blocks, so only the entries that share a block with the query are compared.
+class HammingNeighbourIndex {
+    public:
+        int length = 0;
+        int radius = -1;
+
+        HammingNeighbourIndex() {}
+
+        HammingNeighbourIndex(int length, int radius) {
+            this->length = length;
+            this->radius = radius;
+            int numBlocks = std::max(1, std::min(radius + 1, length));
+            for (int block = 0; block <= numBlocks; block++) {
+                this->blockStarts.push_back(block * length / numBlocks);
+            }
+            this->blocks.resize(numBlocks);
+        }
+
+        bool isEnabled() const {
+            return this->radius >= 0;
+        }
+
+        // add a sequence to the index, ignoring any of the wrong length
+        void insert(const std::string& sequence) {
+            if (sequence.size() != this->length) {
+                return;
+            }
+            int id = this->entries.size();
+            this->entries.push_back(::toRNA(sequence));
+            for (int block = 0; block < this->blocks.size(); block++) {
+                this->blocks[block][this->blockKey(this->entries[id], block)].push_back(id);
+            }
+        }
+
+        // remove a sequence from the index. The entry is only marked as
+        // removed, since removals are rare
+        void erase(const std::string& sequence) {
+            if (sequence.size() != this->length) {
+                return;
+            }
+            std::string entry = ::toRNA(sequence);
+            for (int id : this->blocks[0][this->blockKey(entry, 0)]) {
+                if (this->entries[id] == entry) {
+                    this->entries[id].clear();
+                }
+            }
+        }
+
+        // check whether the sequence is within the radius of any entry
+        bool containsNeighbourOf(const std::string& sequence) const {
+            if (sequence.size() != this->length) {
+                return false;
+            }
+            std::string query = ::toRNA(sequence);
+            for (int block = 0; block < this->blocks.size(); block++) {
+                auto candidates = this->blocks[block].find(this->blockKey(query, block));
+                if (candidates == this->blocks[block].end()) {
+                    continue;
+                }
+                for (int id : candidates->second) {
+                    METRICS.indexProbes.fetch_add(1, std::memory_order_relaxed);
+                    if (this->isWithinRadius(this->entries[id], query)) {
+                        return true;
+                    }
+                }
+            }
+            return false;
+        }
+
+    private:
+        std::vector<std::string> entries;
+        std::vector<int> blockStarts;
+        std::vector<std::unordered_map<uint64_t, std::vector<int> > > blocks;
+
+        uint64_t blockKey(const std::string& sequence, int block) const {
+            return packedSubstringKey(sequence, this->blockStarts[block], this->blockStarts[block + 1] - this->blockStarts[block]);
+        }
+
+        bool isWithinRadius(const std::string& entry, const std::string& query) const {
+            if (entry.empty()) {
+                return false;
+            }
+            int mismatches = 0;
+            for (int i = 0; i < this->length; i++) {
+                mismatches += entry[i] != query[i];
+                if (mismatches > this->radius) {
+                    return false;
+                }
+            }
+            return true;
+        }
+};
+
+
+// a screen against cross-hybridization: a barcode is rejected if its reverse
+// complement is within the radius of any accepted barcode, or of any part of
+// the constant regions, since it could then pair with them. Barcodes are
+// compared by their stems alone, since the loop of one is never complementary
+// to the loop of another, and would otherwise add mismatches to every pair.
+// The constant regions are slid along the reverse complement, or it along
+// them, whichever is shorter, and compared where one lies wholly on the other.
+class HybridizationScreen {
+    public:
+        int stemLength = 0;
+        int loopLength = 0;
+        int radius = -1;
+        HammingNeighbourIndex index;
+        std::vector<std::string> constantRegions;
+
+        HybridizationScreen() {}
+
+        HybridizationScreen(int stemLength, int loopLength, int radius, std::vector<std::string> constantRegions) {
+            this->stemLength = stemLength;
+            this->loopLength = loopLength;
+            this->radius = radius;
+            this->index = HammingNeighbourIndex(2 * stemLength, radius);
+            for (std::string constantRegion : constantRegions) {
+                if (!constantRegion.empty()) {
+                    this->constantRegions.push_back(::toRNA(constantRegion));
+                }
+            }
+        }
+
+        bool isEnabled() const {
+            return this->index.isEnabled();
+        }
+
+        void accept(const std::string& barcode) {
+            this->index.insert(this->stemOf(barcode));
+        }
+
+        void release(const std::string& barcode) {
+            this->index.erase(this->stemOf(barcode));
+        }
+
+        bool mayHybridize(const std::string& barcode) const {
+            std::string complement = reverseComplement(barcode);
+            if (this->index.containsNeighbourOf(this->stemOf(complement))) {
+                return true;
+            }
+            for (const std::string& constantRegion : this->constantRegions) {
+                if (this->isWithinRadiusOfPart(complement, constantRegion)) {
+                    return true;
+                }
+            }
+            return false;
+        }
+
+    private:
+        // the two arms of a barcode, without its loop, or an empty string if
+        // the barcode is not of the screened length
+        std::string stemOf(const std::string& barcode) const {
+            if (barcode.size() != 2 * this->stemLength + this->loopLength) {
+                return "";
+            }
+            return barcode.substr(0, this->stemLength) + barcode.substr(this->stemLength + this->loopLength);
+        }
+
+        // whether the shorter of two sequences is within the radius of any
+        // part of the longer
+        bool isWithinRadiusOfPart(const std::string& first, const std::string& second) const {
+            const std::string& shorter = first.size() <= second.size() ? first : second;
+            const std::string& longer = first.size() <= second.size() ? second : first;
+            for (int offset = 0; offset + shorter.size() <= longer.size(); offset++) {
+                METRICS.indexProbes.fetch_add(1, std::memory_order_relaxed);
+                int mismatches = 0;
+                for (int i = 0; i < shorter.size() && mismatches <= this->radius; i++) {
+                    mismatches += shorter[i] != longer[offset + i];
+                }
+                if (mismatches <= this->radius) {
+                    return true;
+                }
+            }
+            return false;
+        }
+};
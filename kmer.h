@@ -0,0 +1,131 @@
+// kmer.h
+
+#include <atomic>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+
+// the longest k-mer that can be indexed, so that every k-mer plus one fits in
+// 64 bits and zero can mark an empty slot
+const int KMER_MAX_LENGTH = 31;
+
+
+// call fn on the packed code of every k-mer of the sequence, skipping any
+// k-mer that contains a base other than A, C, G, U or T. If reverseComplement
+// is set, the codes are of the reverse complement of each k-mer instead.
+template <typename Function>
+void forEachKmer(const std::string& sequence, int k, bool reverseComplement, Function fn) {
+    uint64_t mask = (1ULL << (2 * k)) - 1;
+    uint64_t forward = 0;
+    uint64_t reverse = 0;
+    int valid = 0;
+    for (char base : sequence) {
+        int8_t code = packedBaseCode(base);
+        if (code < 0) {
+            valid = 0;
+            continue;
+        }
+        forward = ((forward << 2) | code) & mask;
+        reverse = (reverse >> 2) | ((uint64_t) packedComplementCode(code) << (2 * (k - 1)));
+        if (++valid >= k) {
+            fn(reverseComplement ? reverse : forward);
+        }
+    }
+}
+
+
+// a set of packed k-mers, stored in an open addressing hash table with linear
+// probing. Insertion is lock-free, so the index can be built from many threads
+// at once, and lookups are a constant number of probes on average.
+class KmerIndex {
+    public:
+        int k = 0;
+
+        KmerIndex() {}
+
+        KmerIndex(int k, long long expectedKmers) {
+            if (k > KMER_MAX_LENGTH) {
+                std::cerr << "Error: k-mers longer than " << KMER_MAX_LENGTH << " cannot be indexed." << std::endl;
+                exit(EXIT_FAILURE);
+            }
+            this->k = k;
+
+            // keep the table at most half full
+            long long capacity = 1024;
+            while (capacity < 2 * expectedKmers) {
+                capacity *= 2;
+            }
+            this->slots = std::vector<std::atomic<uint64_t> >(capacity);
+            this->mask = capacity - 1;
+        }
+
+        bool isEnabled() const {
+            return this->k > 0;
+        }
+
+        // insert a packed k-mer, returning whether it was not already present
+        bool insert(uint64_t kmer) {
+            uint64_t key = kmer + 1;
+            for (uint64_t slot = packedHash(key) & this->mask; ; slot = (slot + 1) & this->mask) {
+                uint64_t current = this->slots[slot].load(std::memory_order_relaxed);
+                if (current == key) {
+                    return false;
+                }
+                if (current == 0) {
+                    if (this->slots[slot].compare_exchange_strong(current, key)) {
+                        return true;
+                    }
+                    if (current == key) {
+                        return false;
+                    }
+                }
+            }
+        }
+
+        bool contains(uint64_t kmer) const {
+            uint64_t key = kmer + 1;
+            for (uint64_t slot = packedHash(key) & this->mask; ; slot = (slot + 1) & this->mask) {
+                uint64_t current = this->slots[slot].load(std::memory_order_relaxed);
+                if (current == key) {
+                    return true;
+                }
+                if (current == 0) {
+                    return false;
+                }
+            }
+        }
+
+        // insert every k-mer of a sequence
+        void insertAll(const std::string& sequence) {
+            forEachKmer(sequence, this->k, false, [&](uint64_t kmer) {
+                this->insert(kmer);
+            });
+        }
+
+        // check whether any k-mer of the sequence, or of its reverse
+        // complement, is in the index
+        bool containsAnyKmerOf(const std::string& sequence) const {
+            bool found = false;
+            for (int reverseComplement = 0; reverseComplement < 2 && !found; reverseComplement++) {
+                forEachKmer(sequence, this->k, reverseComplement, [&](uint64_t kmer) {
+                    found = found || this->contains(kmer);
+                });
+            }
+            return found;
+        }
+
+        // the number of distinct k-mers in the index, which is counted rather
+        // than tracked so that insertion stays a single atomic operation
+        long long size() const {
+            long long numKmers = 0;
+            for (const std::atomic<uint64_t>& slot : this->slots) {
+                numKmers += slot.load(std::memory_order_relaxed) != 0;
+            }
+            return numKmers;
+        }
+
+    private:
+        std::vector<std::atomic<uint64_t> > slots;
+        uint64_t mask = 0;
+};
@@ -1,7 +1,26 @@
 // library.h
 
+#include "metrics.h"
+#include "parallel.h"
+#include "packed.h"
+#include "statistics.h"
 #include "fasta.h"
+#include "kmer.h"
+#include "minhash.h"
+#include "hybridization.h"
+#include "editdistance.h"
+#include "constraints.h"
+#include "bulkrandom.h"
+#include "stemkernels.h"
+#include "composition.h"
+#include "bitmap.h"
 #include "stem.h"
+#include "padding.h"
+#include "fold.h"
+#include "audit.h"
+#include "output.h"
+#include "append.h"
+#include "registry.h"
 #include <string>
 #include <vector>
 #include <iostream>
@@ -55,6 +74,10 @@ class LibrarySequence {
         // sublibrary it belongs to
         std::string name;
 
+        // whether the barcode was read from the input, in which case it is
+        // never regenerated
+        bool barcodeIsFixed = false;
+
         LibrarySequence(
             const std::string& fivePrimeConstantRegion = "",
             std::string fivePrimePadding = "",
@@ -115,15 +138,23 @@ class LibrarySequence {
 
             // while the barcode has a hamming distance less than two from all
             // other barcodes, generate a new barcode
+            long long rejections = 0;
             while (!barcode.verifyHammingDistance(barcodes)) {
                 barcode = Barcode(barcodeLength, maxOccurences, barcodeStemLoop);
+                rejections++;
             }
+            METRICS.recordBarcode(rejections);
 
             // set the barcode of the library sequence
             this->barcode = barcode.toString();
 
-            // add the barcode to the set of barcodes
+            // add the barcode to the set of barcodes, noting whether the set
+            // had to rehash to accommodate it
+            size_t bucketCount = barcodes.bucket_count();
             barcodes.insert(this->barcode);
+            if (barcodes.bucket_count() != bucketCount) {
+                METRICS.rehashEvents.fetch_add(1, std::memory_order_relaxed);
+            }
         }
 
 
@@ -142,6 +173,14 @@ class LibrarySequence {
             return this->fivePrimeConstantRegion.size() + this->fivePrimePadding.size() + this->designRegion.size() + this->threePrimePadding.size() + this->barcode.size() + this->threePrimeConstantRegion.size();
         }
 
+        // the sublibrary of the sequence, which is the part of its name before
+        // the first delimiter, or the whole name if there is none
+        std::string sublibrary(char delimiter) {
+            int start = !this->name.empty() && this->name[0] == '>';
+            size_t end = this->name.find(delimiter, start);
+            return this->name.substr(start, end == std::string::npos ? std::string::npos : end - start);
+        }
+
         int designRegionLength() {
             return this->designRegion.size();
         }
@@ -178,16 +217,98 @@ class LibrarySequence {
             this->barcode = "";
         }
 
+
+        // check that the padding stems and the barcode fold into their
+        // intended hairpins in the context of the full construct. A bit is set
+        // in the result for each part that does not: 1 for the 5' padding, 2
+        // for the 3' padding and 4 for the barcode.
+        int foldingFailures(
+            HairpinFolder& folder,
+            int context,
+            int minStemLength,
+            int maxStemLength,
+            int loopLength
+            ) {
+            std::string sequence = this->toString();
+            int failures = 0;
+
+            int offset = this->fivePrimeConstantRegion.size();
+            if (!paddingFoldsAsIntended(folder, sequence, offset, this->fivePrimePadding.size(), minStemLength, maxStemLength, loopLength, context)) {
+                failures |= 1;
+            }
+
+            offset += this->fivePrimePadding.size() + this->designRegion.size();
+            if (!paddingFoldsAsIntended(folder, sequence, offset, this->threePrimePadding.size(), minStemLength, maxStemLength, loopLength, context)) {
+                failures |= 2;
+            }
+
+            offset += this->threePrimePadding.size();
+            if (this->barcode.size() > loopLength && this->barcode != "N") {
+                METRICS.foldChecks.fetch_add(1, std::memory_order_relaxed);
+                int stemLength = (this->barcode.size() - loopLength) / 2;
+                if (!folder.foldsAsIntended(sequence, offset, stemLength, loopLength, context)) {
+                    failures |= 4;
+                }
+            }
+
+            return failures;
+        }
+
 };
 
 
 
+// a subset of a library that is written to its own files
+typedef struct {
+    std::string name;
+    std::vector<long long> indices;
+} LibraryShard;
+
+
 class Library {
     public:
         std::vector<LibrarySequence> librarySequnces;
         std::unordered_set<std::string> barcodes;
         std::string barcodeStemLoop;
 
+        // the barcodes of the length being generated as a bitmap, which
+        // replaces the set for the hamming distance check of short barcodes,
+        // if it has been built
+        BarcodeBitmap barcodeBitmap;
+
+        // the constraints that generated barcodes and padding must satisfy
+        SequenceConstraints constraints;
+
+        // the k-mers of the design and constant regions, which generated
+        // barcodes and padding must avoid, if the index has been built
+        KmerIndex designKmers;
+
+        // the screen against barcodes that could pair with other barcodes or
+        // with the constant regions, if it has been built
+        HybridizationScreen hybridizationScreen;
+
+        // the index of barcodes used to keep every pair of barcodes apart by
+        // a minimum edit distance, if it has been built
+        EditDistanceIndex editDistanceIndex;
+
+        // the base pairs allowed at each position of the barcode stems, as
+        // masks of their indices in RNA_PAIRS, or empty if any are allowed
+        std::vector<uint8_t> allowedBarcodePairs;
+
+        // the number of barcodes of an existing library that this library is
+        // appended to, which are in the set of barcodes but not in the library
+        long long existingBarcodeCount = 0;
+
+        // the shared registry that barcodes are claimed from, if connected,
+        // and the barcodes, in RNA, that this library added to it
+        BarcodeRegistryClient registry;
+        std::unordered_set<std::string> registeredBarcodes;
+
+        // the design regions at two bits per base, when they have been packed,
+        // in which case the design region of each sequence is left empty
+        std::vector<PackedSequence> packedDesignRegions;
+        bool designRegionsArePacked = false;
+
         Library(
             std::vector<LibrarySequence> librarySequnces = {},
             std::unordered_set<std::string> barcodes = {},
@@ -239,6 +360,7 @@ class Library {
                             nonUniqueBarcodes++;
                         } else {
                             this->barcodes.insert(librarySequence.barcode);
+                            librarySequence.barcodeIsFixed = true;
                         }
                     } else {
                         this->barcodes.insert(librarySequence.barcode);
@@ -265,15 +387,19 @@ class Library {
 
 
         void replaceFivePrimeConstantRegion(std::string sequence) {
-            for (LibrarySequence& librarySequence : *this) {
-                librarySequence.fivePrimeConstantRegion = sequence;
-            }
+            parallelFor(this->size(), [&](long long begin, long long end, int thread) {
+                for (long long i = begin; i < end; i++) {
+                    this->librarySequnces[i].fivePrimeConstantRegion = sequence;
+                }
+            });
         }
 
         void replaceThreePrimeConstantRegion(std::string sequence) {
-            for (LibrarySequence& librarySequence : *this) {
-                librarySequence.threePrimeConstantRegion = sequence;
-            }
+            parallelFor(this->size(), [&](long long begin, long long end, int thread) {
+                for (long long i = begin; i < end; i++) {
+                    this->librarySequnces[i].threePrimeConstantRegion = sequence;
+                }
+            });
         }
 
 
@@ -283,39 +409,45 @@ class Library {
             int maxStemLength, 
             std::vector<int> maxOccurences
             ) {
-            for (LibrarySequence& librarySequence : *this) {
-                librarySequence.addFivePrimePadding(
-                    length - librarySequence.paddedDesignRegionLength(),
-                    minStemLength, 
-                    maxStemLength, 
-                    maxOccurences, 
-                    this->barcodeStemLoop
-                    );
-            }
+            // generate the padding of every sequence in bulk
+            std::vector<int> paddingLengths(this->size());
+            parallelFor(this->size(), [&](long long begin, long long end, int thread) {
+                for (long long i = begin; i < end; i++) {
+                    paddingLengths[i] = length - this->paddedDesignRegionLength(i);
+                }
+            });
+            PaddingEngine engine = PaddingEngine(minStemLength, maxStemLength, maxOccurences, this->barcodeStemLoop, this->constraints);
+            engine.screen = &this->designKmers;
+            std::vector<std::string> paddings = engine.generate(paddingLengths);
+
+            parallelFor(this->size(), [&](long long begin, long long end, int thread) {
+                for (long long i = begin; i < end; i++) {
+                    this->librarySequnces[i].fivePrimePadding = std::move(paddings[i]);
+                }
+            });
 
         }
 
 
         int removeBarcode(std::string barcode) {
 
-            // a counter to keep track of the number of barcodes removed
-            int numBarcodesRemoved = 0;
-
-            // create an iterator to loop over the vector
-            auto it = this->librarySequnces.begin();
-
-            // loop over the vector using the iterator
-            while (it != this->librarySequnces.end()) {
-                LibrarySequence& librarySequence = *it;
-                if (librarySequence.barcode == barcode) {
-                    librarySequence.removeBarcode();
-                    numBarcodesRemoved++;
+            // remove the barcode from every sequence that has it, counting them
+            int numBarcodesRemoved = parallelReduce(this->size(), 0, [&](long long begin, long long end) {
+                int removed = 0;
+                for (long long i = begin; i < end; i++) {
+                    if (this->librarySequnces[i].barcode == barcode) {
+                        this->librarySequnces[i].removeBarcode();
+                        removed++;
+                    }
                 }
-                it++;
-            }
+                return removed;
+            }, std::plus<int>());
 
             // remove the barcode from the set of barcodes
             this->barcodes.erase(barcode);
+            if (this->barcodeBitmap.isEnabled()) {
+                this->barcodeBitmap.erase(barcode);
+            }
 
             return numBarcodesRemoved;
         }
@@ -327,14 +459,287 @@ class Library {
             int maxStemLength, 
             std::vector<int> maxOccurences
             ) {
+            // generate the padding of every sequence in bulk
+            std::vector<int> paddingLengths(this->size());
+            parallelFor(this->size(), [&](long long begin, long long end, int thread) {
+                for (long long i = begin; i < end; i++) {
+                    paddingLengths[i] = length - this->paddedDesignRegionLength(i);
+                }
+            });
+            PaddingEngine engine = PaddingEngine(minStemLength, maxStemLength, maxOccurences, this->barcodeStemLoop, this->constraints);
+            engine.screen = &this->designKmers;
+            std::vector<std::string> paddings = engine.generate(paddingLengths);
+
+            parallelFor(this->size(), [&](long long begin, long long end, int thread) {
+                for (long long i = begin; i < end; i++) {
+                    this->librarySequnces[i].threePrimePadding = std::move(paddings[i]);
+                }
+            });
+        }
+
+
+        // build the index of the k-mers of every design region and of the given
+        // constant regions, in parallel
+        void buildKmerIndex(int k, std::vector<std::string> constantRegions) {
+            long long expectedKmers = 0;
             for (LibrarySequence& librarySequence : *this) {
-                librarySequence.addThreePrimePadding(
-                    length - librarySequence.paddedDesignRegionLength(),
-                    minStemLength, 
-                    maxStemLength, 
-                    maxOccurences, 
-                    this->barcodeStemLoop
-                    );
+                expectedKmers += std::max(0, (int) librarySequence.designRegion.size() - k + 1);
+            }
+            for (std::string constantRegion : constantRegions) {
+                expectedKmers += std::max(0, (int) constantRegion.size() - k + 1);
+            }
+
+            this->designKmers = KmerIndex(k, expectedKmers);
+            for (std::string constantRegion : constantRegions) {
+                this->designKmers.insertAll(constantRegion);
+            }
+            parallelFor(this->size(), [&](long long begin, long long end, int thread) {
+                for (long long i = begin; i < end; i++) {
+                    this->designKmers.insertAll(this->librarySequnces[i].designRegion);
+                }
+            });
+        }
+
+
+        // cluster the sequences whose design regions are near duplicates, with
+        // an estimated Jaccard similarity of their k-mers of at least threshold,
+        // and, if maxPerCluster is positive, remove all but the first
+        // maxPerCluster sequences of each cluster. The design regions of an
+        // existing library that this one is appended to are clustered too, and
+        // come first, so they count towards the cap but are never removed.
+        // Returns the number of clusters with more than one sequence.
+        long long capNearDuplicates(double threshold, int maxPerCluster, int k, const std::vector<std::string>& existingDesignRegions = {}) {
+            long long numExisting = existingDesignRegions.size();
+            std::vector<long long> clusters = clusterNearDuplicates(numExisting + this->size(), [&](long long i) -> const std::string& {
+                return i < numExisting ? existingDesignRegions[i] : this->librarySequnces[i - numExisting].designRegion;
+            }, threshold, k);
+
+            long long numClusters;
+            std::vector<long long> kept = thinClusters(clusters, maxPerCluster, numClusters);
+            std::vector<bool> isKept(this->size(), false);
+            long long numRemoved = this->size();
+            for (long long i : kept) {
+                if (i >= numExisting) {
+                    isKept[i - numExisting] = true;
+                    numRemoved--;
+                }
+            }
+            if (numRemoved > 0) {
+                std::vector<LibrarySequence> librarySequnces;
+                librarySequnces.reserve(this->size() - numRemoved);
+                for (long long i = 0; i < this->size(); i++) {
+                    if (isKept[i]) {
+                        librarySequnces.push_back(std::move(this->librarySequnces[i]));
+                    } else if (this->librarySequnces[i].barcode.size() > 0 && this->librarySequnces[i].barcode != "N") {
+                        this->barcodes.erase(this->librarySequnces[i].barcode);
+                        if (this->barcodeBitmap.isEnabled()) {
+                            this->barcodeBitmap.erase(this->librarySequnces[i].barcode);
+                        }
+                    }
+                }
+                this->librarySequnces = std::move(librarySequnces);
+            }
+
+            std::cout << "Found " << numClusters << " clusters of near-duplicate design regions. " << numRemoved << " sequences were removed to keep at most " << maxPerCluster << " per cluster." << std::endl;
+            return numClusters;
+        }
+
+
+        // build the cross-hybridization screen over the barcodes already in the
+        // library and the given constant regions
+        void buildHybridizationScreen(int barcodeLength, int radius, std::vector<std::string> constantRegions) {
+            this->hybridizationScreen = HybridizationScreen(barcodeLength, this->barcodeStemLoop.size(), radius, constantRegions);
+            for (const std::string& barcode : this->barcodes) {
+                this->hybridizationScreen.accept(barcode);
+            }
+        }
+
+
+        // build the index that keeps every pair of barcodes at least
+        // minEditDistance insertions, deletions or substitutions apart
+        void buildEditDistanceIndex(int barcodeLength, int minEditDistance) {
+            int length = 2 * barcodeLength + this->barcodeStemLoop.size();
+            int loopStart = barcodeLength;
+            int loopEnd = barcodeLength + this->barcodeStemLoop.size();
+            this->editDistanceIndex = EditDistanceIndex(length, minEditDistance - 1, loopStart, loopEnd);
+            for (const std::string& barcode : this->barcodes) {
+                if (barcode != "N") {
+                    this->editDistanceIndex.insert(barcode);
+                }
+            }
+        }
+
+
+        // build the bitmap of the barcodes of the given length, setting the
+        // bits of the barcodes already in the library in parallel
+        void buildBarcodeBitmap(int barcodeLength) {
+            this->barcodeBitmap = BarcodeBitmap(barcodeLength, this->barcodeStemLoop);
+            std::vector<const std::string*> barcodes;
+            barcodes.reserve(this->barcodes.size());
+            for (const std::string& barcode : this->barcodes) {
+                barcodes.push_back(&barcode);
+            }
+            parallelFor(barcodes.size(), [&](long long begin, long long end, int thread) {
+                for (long long i = begin; i < end; i++) {
+                    this->barcodeBitmap.insert(*barcodes[i]);
+                }
+            });
+        }
+
+
+        // check whether a candidate barcode may be added to the library: it must
+        // be at a hamming distance of at least two from every other barcode,
+        // must not share a k-mer with any design or constant region, its
+        // reverse complement must not be close to any other barcode or
+        // constant region, and it must be at the minimum edit distance from
+        // every other barcode
+        bool isAcceptableBarcode(Barcode& barcode) {
+            if (this->barcodeBitmap.matches(barcode.basePairs.size(), barcode.stemLoop)) {
+                if (!barcode.verifyHammingDistance(this->barcodeBitmap)) {
+                    return false;
+                }
+            } else if (!barcode.verifyHammingDistance(this->barcodes)) {
+                return false;
+            }
+            if (this->designKmers.isEnabled() && this->designKmers.containsAnyKmerOf(barcode.toString())) {
+                METRICS.kmerScreenRejections.fetch_add(1, std::memory_order_relaxed);
+                return false;
+            }
+            if (this->hybridizationScreen.isEnabled() && this->hybridizationScreen.mayHybridize(barcode.toString())) {
+                METRICS.hybridizationRejections.fetch_add(1, std::memory_order_relaxed);
+                return false;
+            }
+            if (this->editDistanceIndex.isEnabled() && this->editDistanceIndex.containsNeighbourOf(barcode.toString())) {
+                METRICS.editDistanceRejections.fetch_add(1, std::memory_order_relaxed);
+                return false;
+            }
+            return true;
+        }
+
+
+        // add a barcode to the set of barcodes, noting whether the set had to
+        // rehash to accommodate it, and to any index of barcodes
+        void acceptBarcode(const std::string& barcode) {
+            size_t bucketCount = this->barcodes.bucket_count();
+            this->barcodes.insert(barcode);
+            if (this->barcodes.bucket_count() != bucketCount) {
+                METRICS.rehashEvents.fetch_add(1, std::memory_order_relaxed);
+            }
+            if (this->barcodeBitmap.isEnabled()) {
+                this->barcodeBitmap.insert(barcode);
+            }
+            if (this->hybridizationScreen.isEnabled()) {
+                this->hybridizationScreen.accept(barcode);
+            }
+            if (this->editDistanceIndex.isEnabled()) {
+                this->editDistanceIndex.insert(barcode);
+            }
+        }
+
+
+        // remove a barcode from the set of barcodes and from any index of them
+        void releaseBarcode(const std::string& barcode) {
+            this->barcodes.erase(barcode);
+            if (this->barcodeBitmap.isEnabled()) {
+                this->barcodeBitmap.erase(barcode);
+            }
+            if (this->hybridizationScreen.isEnabled()) {
+                this->hybridizationScreen.release(barcode);
+            }
+            if (this->editDistanceIndex.isEnabled()) {
+                this->editDistanceIndex.erase(barcode);
+            }
+        }
+
+
+        // whether the shared registry, if connected, would reject a barcode as
+        // too close to one already registered
+        bool isExcludedByRegistry(const std::string& barcode) {
+            return this->registry.isEnabled() && !this->registry.check({barcode})[0];
+        }
+
+
+        // remove a barcode from the shared registry, if this library added it
+        void unregisterBarcode(const std::string& barcode) {
+            if (this->registry.isEnabled() && this->registeredBarcodes.erase(::toRNA(barcode)) > 0) {
+                this->registry.release({::toRNA(barcode)});
+            }
+        }
+
+
+        // accept the barcode a sequence was given in place of original, which
+        // was released from the library to draw it. If the library is connected
+        // to a registry, the new barcode is reserved there and the original
+        // released, unless the registry no longer accepts the new barcode, in
+        // which case the original is kept. Returns whether the barcode was
+        // replaced.
+        bool replaceBarcode(LibrarySequence& librarySequence, const std::string& original) {
+            if (librarySequence.barcode == original) {
+                this->acceptBarcode(original);
+                return false;
+            }
+            if (librarySequence.barcode.empty()) {
+                this->unregisterBarcode(original);
+                return false;
+            }
+            if (this->registry.isEnabled()) {
+                if (!this->registry.reserve({librarySequence.barcode})[0]) {
+                    METRICS.registryRejections.fetch_add(1, std::memory_order_relaxed);
+                    librarySequence.barcode = original;
+                    this->acceptBarcode(original);
+                    return false;
+                }
+                this->registeredBarcodes.insert(::toRNA(librarySequence.barcode));
+                this->unregisterBarcode(original);
+            }
+            this->acceptBarcode(librarySequence.barcode);
+            return true;
+        }
+
+
+        // draw random barcodes until one may be added to the library, and is
+        // not excluded by the given check, counting the candidates rejected.
+        // Returns an empty string if none is found within the maximum number
+        // of attempts, as when a short k-mer screen rejects every candidate.
+        std::string drawBarcode(
+            int barcodeLength,
+            const std::vector<int>& maxOccurences,
+            std::mt19937& gen,
+            long long& rejections,
+            const std::function<bool(const std::string&)>& isExcluded = nullptr
+            ) {
+            for (int attempt = 0; attempt < CONSTRAINT_MAX_ATTEMPTS; attempt++) {
+                Barcode barcode = Barcode(barcodeLength, maxOccurences, this->barcodeStemLoop, gen, this->constraints, this->allowedBarcodePairs);
+                if (this->isAcceptableBarcode(barcode)) {
+                    std::string sequence = barcode.toString();
+                    if (!isExcluded || !isExcluded(sequence)) {
+                        return sequence;
+                    }
+                }
+                rejections++;
+            }
+            return "";
+        }
+
+        std::string drawBarcode(int barcodeLength, const std::vector<int>& maxOccurences, std::mt19937& gen) {
+            long long rejections = 0;
+            return this->drawBarcode(barcodeLength, maxOccurences, gen, rejections);
+        }
+
+        // draw a barcode that the shared registry, if connected, would accept
+        std::string drawRegistrableBarcode(int barcodeLength, const std::vector<int>& maxOccurences, std::mt19937& gen) {
+            long long rejections = 0;
+            return this->drawBarcode(barcodeLength, maxOccurences, gen, rejections, [&](const std::string& barcode) {
+                return this->isExcludedByRegistry(barcode);
+            });
+        }
+
+
+        // report the sequences left without a barcode because no candidate
+        // could be found for them
+        void reportUnplacedBarcodes(long long numUnplaced) {
+            if (numUnplaced > 0) {
+                std::cout << "Error: no barcode that passes every check was found in " << CONSTRAINT_MAX_ATTEMPTS << " attempts, so " << numUnplaced << " sequences were left without a barcode." << std::endl;
             }
         }
 
@@ -343,26 +748,44 @@ class Library {
             int barcodeLength, 
             std::vector<int> maxOccurences
             ) {
+            std::random_device rd;
+            std::mt19937 gen(rd());
+
+            // short barcodes are checked against a bitmap of every barcode
+            if (barcodeLength <= BARCODE_BITMAP_MAX_LENGTH && !this->barcodeBitmap.matches(barcodeLength, this->barcodeStemLoop)) {
+                this->buildBarcodeBitmap(barcodeLength);
+            }
+
+            if (this->registry.isEnabled()) {
+                this->barcodeFromRegistry(barcodeLength, maxOccurences, gen);
+                return;
+            }
+
             int n = 0;
+            long long numUnplaced = 0;
             for (LibrarySequence& librarySequence : *this) {
                 // if the sequence already has a barcode, skip it, else add one
                 if (librarySequence.barcode.size() > 0) {
                     continue;
+                } else if (numUnplaced > 0) {
+                    // once no barcode can be found, the rest are not tried
+                    numUnplaced++;
+                    continue;
                 } else {
-                    // create a barcode object
-                    Barcode barcode = Barcode(barcodeLength, maxOccurences, barcodeStemLoop);
-
-                    // while the barcode has a hamming distance less than two from all
-                    // other barcodes, generate a new barcode
-                    while (!barcode.verifyHammingDistance(barcodes)) {
-                        barcode = Barcode(barcodeLength, maxOccurences, barcodeStemLoop);
+                    // draw barcodes until one is at a hamming distance of at
+                    // least two from all other barcodes and passes the screens
+                    long long rejections = 0;
+                    std::string barcode = this->drawBarcode(barcodeLength, maxOccurences, gen, rejections);
+                    if (barcode.empty()) {
+                        numUnplaced++;
+                        continue;
                     }
+                    METRICS.recordBarcode(rejections);
 
                     // set the barcode of the library sequence
-                    librarySequence.barcode = barcode.toString();
+                    librarySequence.barcode = barcode;
 
-                    // add the barcode to the set of barcodes
-                    this->barcodes.insert(librarySequence.barcode);
+                    this->acceptBarcode(librarySequence.barcode);
                 }
 
                 n++;
@@ -371,31 +794,588 @@ class Library {
                 }
 
             }
+            this->reportUnplacedBarcodes(numUnplaced);
+
+            // record the final state of the barcode set
+            METRICS.barcodeSetLoadFactor = this->barcodes.load_factor();
+            METRICS.barcodeSetBucketCount = this->barcodes.bucket_count();
+        }
+
+
+        // claim the barcodes of the library from the shared registry, so that
+        // they stay apart from those of every other library designed against
+        // it. The barcodes read from the input are registered first. Then, in
+        // batches, a candidate that passes the local checks is drawn for every
+        // sequence without a barcode, and the batch is reserved in one round
+        // trip. Candidates the registry rejects, being too close to a barcode
+        // of another library, are drawn again in the next batch.
+        void barcodeFromRegistry(int barcodeLength, std::vector<int> maxOccurences, std::mt19937& gen) {
+            std::vector<std::string> inputBarcodes;
+            std::vector<long long> pending;
+            for (long long i = 0; i < this->size(); i++) {
+                const std::string& barcode = this->librarySequnces[i].barcode;
+                if (barcode.empty()) {
+                    pending.push_back(i);
+                } else if (barcode != "N") {
+                    inputBarcodes.push_back(::toRNA(barcode));
+                }
+            }
+            std::vector<uint8_t> claimed = this->registry.claim(inputBarcodes);
+            long long numAlreadyRegistered = 0;
+            for (long long k = 0; k < inputBarcodes.size(); k++) {
+                if (claimed[k]) {
+                    this->registeredBarcodes.insert(inputBarcodes[k]);
+                } else {
+                    numAlreadyRegistered++;
+                }
+            }
+            std::cout << "Registered " << inputBarcodes.size() - numAlreadyRegistered << " barcodes of the input. " << numAlreadyRegistered << " were already in the registry." << std::endl;
+
+            std::vector<long long> rejections(this->size(), 0);
+            bool exhausted = false;
+            long long numGivenUp = 0;
+            int numFailedRounds = 0;
+            while (!pending.empty() && !exhausted && numFailedRounds < REGISTRY_MAX_FAILED_ROUNDS) {
+                long long batchSize = std::min<long long>(pending.size(), REGISTRY_BATCH_SIZE);
+                std::vector<std::string> candidates;
+                for (long long k = 0; k < batchSize; k++) {
+                    LibrarySequence& librarySequence = this->librarySequnces[pending[k]];
+                    librarySequence.barcode = this->drawBarcode(barcodeLength, maxOccurences, gen, rejections[pending[k]]);
+                    if (librarySequence.barcode.empty()) {
+                        exhausted = true;
+                        batchSize = k;
+                        break;
+                    }
+                    this->acceptBarcode(librarySequence.barcode);
+                    candidates.push_back(librarySequence.barcode);
+                }
+
+                // a sequence whose candidates have been rejected too often is
+                // given up on, as drawBarcode gives up on its own
+                std::vector<uint8_t> reserved = this->registry.reserve(candidates);
+                std::vector<long long> rejected;
+                bool anyReserved = false;
+                for (long long k = 0; k < batchSize; k++) {
+                    LibrarySequence& librarySequence = this->librarySequnces[pending[k]];
+                    if (reserved[k]) {
+                        METRICS.recordBarcode(rejections[pending[k]]);
+                        this->registeredBarcodes.insert(::toRNA(librarySequence.barcode));
+                        anyReserved = true;
+                        continue;
+                    }
+                    METRICS.registryRejections.fetch_add(1, std::memory_order_relaxed);
+                    this->releaseBarcode(librarySequence.barcode);
+                    librarySequence.barcode = "";
+                    if (++rejections[pending[k]] >= CONSTRAINT_MAX_ATTEMPTS) {
+                        numGivenUp++;
+                    } else {
+                        rejected.push_back(pending[k]);
+                    }
+                }
+                numFailedRounds = anyReserved || batchSize == 0 ? 0 : numFailedRounds + 1;
+                rejected.insert(rejected.end(), pending.begin() + batchSize, pending.end());
+                pending = std::move(rejected);
+            }
+            if (numFailedRounds >= REGISTRY_MAX_FAILED_ROUNDS) {
+                std::cout << "Error: the registry rejected every candidate in " << REGISTRY_MAX_FAILED_ROUNDS << " batches in a row, so it is taken to be full." << std::endl;
+            }
+            this->reportUnplacedBarcodes(pending.size() + numGivenUp);
+
+            METRICS.barcodeSetLoadFactor = this->barcodes.load_factor();
+            METRICS.barcodeSetBucketCount = this->barcodes.bucket_count();
+        }
+
+
+        // the parts of a construct whose junctions with their neighbours break
+        // the sequence constraints, which each part only satisfies on its own.
+        // As for foldingFailures, a bit is set for each part: 1 for the 5'
+        // padding, 2 for the 3' padding and 4 for the barcode, and 8 if a
+        // junction between two given parts, which cannot be replaced, fails.
+        int junctionFailures(long long i) {
+            LibrarySequence& librarySequence = this->librarySequnces[i];
+            thread_local std::string sequence;
+            sequence.clear();
+            std::vector<std::pair<int, int> > parts;
+            parts.push_back({0, sequence.size()});
+            sequence += librarySequence.fivePrimeConstantRegion;
+            parts.push_back({1, sequence.size()});
+            sequence += librarySequence.fivePrimePadding;
+            parts.push_back({0, sequence.size()});
+            this->appendDesignRegion(i, sequence);
+            parts.push_back({2, sequence.size()});
+            sequence += librarySequence.threePrimePadding;
+            parts.push_back({librarySequence.barcodeIsFixed ? 0 : 4, sequence.size()});
+            sequence += librarySequence.barcode;
+            parts.push_back({0, sequence.size()});
+            sequence += librarySequence.threePrimeConstantRegion;
+            parts.push_back({0, sequence.size()});
+
+            // check the junction at the start of every part that is not
+            // empty, against the last part before it that is not empty
+            int failures = 0;
+            int previous = -1;
+            for (int part = 0; part + 1 < parts.size(); part++) {
+                if (parts[part].second == parts[part + 1].second) {
+                    continue;
+                }
+                if (previous >= 0 && !this->constraints.isSatisfiedAcross(sequence, parts[part].second)) {
+                    int replaceable = parts[previous].first | parts[part].first;
+                    failures |= replaceable == 0 ? 8 : replaceable;
+                }
+                previous = part;
+            }
+            return failures;
+        }
+
+
+        // check the sequence constraints across the junctions between the
+        // parts of every construct, now that they are complete, regenerating
+        // the padding and the barcodes that were not read from the input at
+        // any junction that fails, up to a fixed number of attempts. Returns
+        // the number of constructs with junctions that still fail.
+        int checkJunctions(
+            int barcodeLength,
+            int minStemLength,
+            int maxStemLength,
+            std::vector<int> maxOccurences
+            ) {
+            const int maxAttempts = 100;
+
+            std::vector<int> failures(this->size());
+            parallelFor(this->size(), [&](long long begin, long long end, int thread) {
+                for (long long i = begin; i < end; i++) {
+                    failures[i] = this->junctionFailures(i);
+                }
+            });
+
+            std::random_device rd;
+            std::mt19937 gen(rd());
+            int numFailures = 0;
+            for (long long i = 0; i < this->size(); i++) {
+                if (failures[i] == 0) {
+                    continue;
+                }
+                METRICS.constraintPrunes.fetch_add(1, std::memory_order_relaxed);
+                LibrarySequence& librarySequence = this->librarySequnces[i];
+
+                for (int attempt = 0; attempt < maxAttempts && (failures[i] & 1); attempt++) {
+                    librarySequence.fivePrimePadding = getPadding(librarySequence.fivePrimePadding.size(), minStemLength, maxStemLength, maxOccurences, this->barcodeStemLoop, gen, this->constraints);
+                    if (this->designKmers.isEnabled() && this->designKmers.containsAnyKmerOf(librarySequence.fivePrimePadding)) {
+                        continue;
+                    }
+                    failures[i] = this->junctionFailures(i);
+                }
+                for (int attempt = 0; attempt < maxAttempts && (failures[i] & 2); attempt++) {
+                    librarySequence.threePrimePadding = getPadding(librarySequence.threePrimePadding.size(), minStemLength, maxStemLength, maxOccurences, this->barcodeStemLoop, gen, this->constraints);
+                    if (this->designKmers.isEnabled() && this->designKmers.containsAnyKmerOf(librarySequence.threePrimePadding)) {
+                        continue;
+                    }
+                    failures[i] = this->junctionFailures(i);
+                }
+                if (failures[i] & 4) {
+                    std::string original = librarySequence.barcode;
+                    this->releaseBarcode(original);
+                    for (int attempt = 0; attempt < maxAttempts && (failures[i] & 4); attempt++) {
+                        std::string barcode = this->drawRegistrableBarcode(barcodeLength, maxOccurences, gen);
+                        if (barcode.empty()) {
+                            break;
+                        }
+                        librarySequence.barcode = barcode;
+                        failures[i] = this->junctionFailures(i);
+                    }
+                    if (!this->replaceBarcode(librarySequence, original)) {
+                        failures[i] = this->junctionFailures(i);
+                    }
+                }
+
+                if (failures[i] != 0) {
+                    numFailures++;
+                }
+            }
+
+            return numFailures;
+        }
+
+
+        // check that the padding stems and barcodes of every construct fold
+        // into their intended hairpins, within a window of context bases on
+        // either side. If regenerate is set, the 5' padding and any barcode that
+        // was not read from the input are regenerated until they do, up to a
+        // fixed number of attempts. Returns the number of constructs that still
+        // do not fold as intended.
+        int checkFolding(
+            int context,
+            bool regenerate,
+            int barcodeLength,
+            int minStemLength,
+            int maxStemLength,
+            std::vector<int> maxOccurences
+            ) {
+            const int maxAttempts = 100;
+            int loopLength = this->barcodeStemLoop.size();
+
+            // check every construct in parallel, each thread with its own folder
+            std::vector<int> failures(this->size());
+            parallelFor(this->size(), [&](long long begin, long long end, int thread) {
+                HairpinFolder folder;
+                for (long long i = begin; i < end; i++) {
+                    failures[i] = this->librarySequnces[i].foldingFailures(folder, context, minStemLength, maxStemLength, loopLength);
+                }
+            });
+
+            HairpinFolder folder;
+            std::random_device rd;
+            std::mt19937 gen(rd());
+            int numFailures = 0;
+            for (int i = 0; i < this->size(); i++) {
+                if (failures[i] == 0) {
+                    continue;
+                }
+                METRICS.foldFailures.fetch_add(1, std::memory_order_relaxed);
+                LibrarySequence& librarySequence = this->librarySequnces[i];
+
+                // a replacement must also keep the constraints across the
+                // junctions of the part it replaces
+                if (regenerate && (failures[i] & 1)) {
+                    int paddingLength = librarySequence.fivePrimePadding.size();
+                    for (int attempt = 0; attempt < maxAttempts && (failures[i] & 1); attempt++) {
+                        librarySequence.fivePrimePadding = getPadding(paddingLength, minStemLength, maxStemLength, maxOccurences, this->barcodeStemLoop, gen, this->constraints);
+                        if (this->designKmers.isEnabled() && this->designKmers.containsAnyKmerOf(librarySequence.fivePrimePadding)) {
+                            continue;
+                        }
+                        failures[i] = librarySequence.foldingFailures(folder, context, minStemLength, maxStemLength, loopLength) | (this->junctionFailures(i) & 1);
+                    }
+                }
+
+                if (regenerate && (failures[i] & 4) && !librarySequence.barcodeIsFixed) {
+                    std::string original = librarySequence.barcode;
+                    this->releaseBarcode(original);
+                    for (int attempt = 0; attempt < maxAttempts && (failures[i] & 4); attempt++) {
+                        std::string barcode = this->drawRegistrableBarcode(barcodeLength, maxOccurences, gen);
+                        if (barcode.empty()) {
+                            break;
+                        }
+                        librarySequence.barcode = barcode;
+                        failures[i] = librarySequence.foldingFailures(folder, context, minStemLength, maxStemLength, loopLength) | (this->junctionFailures(i) & 4);
+                    }
+                    this->replaceBarcode(librarySequence, original);
+                }
+
+                if (regenerate) {
+                    failures[i] = librarySequence.foldingFailures(folder, context, minStemLength, maxStemLength, loopLength);
+                }
+                if (failures[i] != 0) {
+                    numFailures++;
+                }
+            }
+
+            return numFailures;
+        }
+
+
+        // audit the barcodes of the library for pairs at a Hamming distance
+        // below threshold, printing a histogram of their distances. Only the
+        // barcodes of the most common length are compared. The barcodes of an
+        // existing library that this one is appended to are audited too. If
+        // fix is set, one barcode of every close pair, preferring one that was
+        // not read from the input and never one of the existing library, is
+        // regenerated until it is at least threshold from every other. Returns
+        // the number of close pairs found.
+        long long auditBarcodes(
+            int threshold,
+            bool fix,
+            int barcodeLength,
+            std::vector<int> maxOccurences,
+            const std::vector<std::string>& existingBarcodes = {}
+            ) {
+
+            // find the most common barcode length
+            std::unordered_map<int, long long> lengthCounts;
+            for (LibrarySequence& librarySequence : *this) {
+                if (librarySequence.barcode.size() > 0 && librarySequence.barcode != "N") {
+                    lengthCounts[librarySequence.barcode.size()]++;
+                }
+            }
+            for (const std::string& barcode : existingBarcodes) {
+                lengthCounts[barcode.size()]++;
+            }
+            int length = 0;
+            for (auto& lengthCount : lengthCounts) {
+                if (length == 0 || lengthCount.second > lengthCounts[length]) {
+                    length = lengthCount.first;
+                }
+            }
+
+            std::vector<std::string> audited;
+            std::vector<int> sequences;
+            for (int i = 0; i < this->size(); i++) {
+                if (this->librarySequnces[i].barcode.size() == length && this->librarySequnces[i].barcode != "N") {
+                    audited.push_back(this->librarySequnces[i].barcode);
+                    sequences.push_back(i);
+                }
+            }
+
+            // the barcodes of the existing library have no sequence here
+            long long numExisting = 0;
+            for (const std::string& barcode : existingBarcodes) {
+                if (barcode.size() == length) {
+                    audited.push_back(barcode);
+                    sequences.push_back(-1);
+                    numExisting++;
+                }
+            }
+            std::vector<BarcodePair> pairs = findClosePairs(audited, threshold);
+            METRICS.auditConflicts.fetch_add(pairs.size(), std::memory_order_relaxed);
+
+            // print the histogram of distances
+            std::vector<long long> histogram(threshold, 0);
+            for (BarcodePair& pair : pairs) {
+                histogram[pair.distance]++;
+            }
+            long long numOtherLengths = lengthCounts.empty() ? 0 : lengthCounts.size() - 1;
+            std::cout << "Audited " << audited.size() << " barcodes of length " << length << ", " << numExisting << " of them from the existing library, skipping " << numOtherLengths << " other lengths. " << pairs.size() << " pairs are closer than " << threshold << " substitutions." << std::endl;
+            for (int distance = 0; distance < threshold; distance++) {
+                std::cout << "    distance " << distance << ": " << histogram[distance] << " pairs" << std::endl;
+            }
+            if (!fix || pairs.empty()) {
+                return pairs.size();
+            }
+
+            // barcodes are regenerated at the generated length, so the close
+            // pairs can only be fixed if that is the length audited
+            int generatedLength = 2 * barcodeLength + this->barcodeStemLoop.size();
+            if (length != generatedLength) {
+                std::cout << "Error: the audited barcodes are " << length << " nt long, but generated barcodes are " << generatedLength << " nt long, so the close pairs were not fixed." << std::endl;
+                return pairs.size();
+            }
+
+            // choose one barcode of every close pair to regenerate. Pairs of
+            // two barcodes of the existing library cannot be fixed.
+            std::vector<bool> regenerate(audited.size(), false);
+            long long numUnfixable = 0;
+            for (BarcodePair& pair : pairs) {
+                if (regenerate[pair.first] || regenerate[pair.second]) {
+                    continue;
+                }
+                if (sequences[pair.first] < 0 && sequences[pair.second] < 0) {
+                    numUnfixable++;
+                    continue;
+                }
+                if (sequences[pair.first] < 0 || sequences[pair.second] < 0) {
+                    regenerate[sequences[pair.first] < 0 ? pair.second : pair.first] = true;
+                    continue;
+                }
+                bool firstIsFixed = this->librarySequnces[sequences[pair.first]].barcodeIsFixed;
+                bool secondIsFixed = this->librarySequnces[sequences[pair.second]].barcodeIsFixed;
+                regenerate[!secondIsFixed || firstIsFixed ? pair.second : pair.first] = true;
+            }
+            if (numUnfixable > 0) {
+                std::cout << numUnfixable << " close pairs are both in the existing library, and so were not fixed." << std::endl;
+            }
+
+            // index the barcodes that are kept, and regenerate the rest
+            HammingNeighbourIndex kept = HammingNeighbourIndex(length, threshold - 1);
+            for (int i = 0; i < audited.size(); i++) {
+                if (!regenerate[i]) {
+                    kept.insert(audited[i]);
+                }
+            }
+            std::random_device rd;
+            std::mt19937 gen(rd());
+            long long numRegenerated = 0;
+            long long numUnplaced = 0;
+            for (int i = 0; i < audited.size(); i++) {
+                if (!regenerate[i]) {
+                    continue;
+                }
+                LibrarySequence& librarySequence = this->librarySequnces[sequences[i]];
+                std::string original = librarySequence.barcode;
+                this->releaseBarcode(original);
+                long long rejections = 0;
+                librarySequence.barcode = this->drawBarcode(barcodeLength, maxOccurences, gen, rejections, [&](const std::string& barcode) {
+                    return kept.containsNeighbourOf(::toRNA(barcode)) || this->isExcludedByRegistry(barcode);
+                });
+                if (!this->replaceBarcode(librarySequence, original)) {
+                    if (librarySequence.barcode.empty()) {
+                        librarySequence.barcodeIsFixed = false;
+                        numUnplaced++;
+                    }
+                    continue;
+                }
+                librarySequence.barcodeIsFixed = false;
+                kept.insert(librarySequence.barcode);
+                numRegenerated++;
+            }
+            std::cout << "Regenerated " << numRegenerated << " barcodes to resolve the close pairs." << std::endl;
+            this->reportUnplacedBarcodes(numUnplaced);
+
+            return pairs.size();
+        }
+
+
+        // add the barcodes of an existing library that this library is to be
+        // appended to, so that new barcodes are checked against them exactly as
+        // they would be if the libraries were designed together. Barcodes read
+        // from the input that are already in the existing library are removed,
+        // since the existing library would have come first.
+        void addExistingBarcodes(const std::vector<std::string>& existingBarcodes) {
+            std::unordered_set<std::string> existing(existingBarcodes.begin(), existingBarcodes.end());
+            int numRemoved = 0;
+            for (LibrarySequence& librarySequence : *this) {
+                if (librarySequence.barcode.size() > 0 && librarySequence.barcode != "N" && existing.count(::toRNA(librarySequence.barcode)) > 0) {
+                    this->releaseBarcode(librarySequence.barcode);
+                    librarySequence.removeBarcode();
+                    librarySequence.barcodeIsFixed = false;
+                    numRemoved++;
+                }
+            }
+            for (const std::string& barcode : existing) {
+                this->acceptBarcode(barcode);
+            }
+            this->existingBarcodeCount = existing.size();
+
+            std::cout << "Loaded " << existing.size() << " barcodes of the existing library. " << numRemoved << " barcodes of the new sequences were already in it, and so were removed." << std::endl;
+        }
+
+
+        // compute the statistics of the library in a single parallel pass,
+        // by region, with the pairs of bases in the barcode stems
+        SequenceStatistics statistics() {
+            std::vector<std::string> regionNames = {"5' constant region", "5' padding", "design region", "3' padding", "barcode", "3' constant region"};
+            return computeStatistics(this->size(), regionNames, 4, this->barcodeStemLoop.size(), [&](long long i, std::vector<const std::string*>& regions) {
+                LibrarySequence& librarySequence = this->librarySequnces[i];
+                regions.push_back(&librarySequence.fivePrimeConstantRegion);
+                regions.push_back(&librarySequence.fivePrimePadding);
+                if (this->designRegionsArePacked) {
+                    thread_local std::string designRegion;
+                    designRegion.clear();
+                    this->packedDesignRegions[i].appendTo(designRegion);
+                    regions.push_back(&designRegion);
+                } else {
+                    regions.push_back(&librarySequence.designRegion);
+                }
+                regions.push_back(&librarySequence.threePrimePadding);
+                regions.push_back(&librarySequence.barcode);
+                regions.push_back(&librarySequence.threePrimeConstantRegion);
+            });
+        }
+
+
+        // store the design regions at two bits per base, freeing their
+        // strings. The lengths, statistics, conversions and output of the
+        // library read the packed design regions, but passes that read the
+        // design regions as strings, such as clustering, the k-mer index and
+        // the fold check, must run before, or after unpackDesignRegions.
+        void packDesignRegions() {
+            if (this->designRegionsArePacked) {
+                return;
+            }
+            this->packedDesignRegions.resize(this->size());
+            parallelFor(this->size(), [&](long long begin, long long end, int thread) {
+                for (long long i = begin; i < end; i++) {
+                    this->packedDesignRegions[i] = PackedSequence(this->librarySequnces[i].designRegion);
+                    std::string().swap(this->librarySequnces[i].designRegion);
+                }
+            });
+            this->designRegionsArePacked = true;
+        }
+
+        void unpackDesignRegions() {
+            if (!this->designRegionsArePacked) {
+                return;
+            }
+            parallelFor(this->size(), [&](long long begin, long long end, int thread) {
+                for (long long i = begin; i < end; i++) {
+                    this->librarySequnces[i].designRegion = this->packedDesignRegions[i].toString();
+                }
+            });
+            std::vector<PackedSequence>().swap(this->packedDesignRegions);
+            this->designRegionsArePacked = false;
+        }
+
+        int designRegionLength(long long i) {
+            return this->designRegionsArePacked ? this->packedDesignRegions[i].size() : this->librarySequnces[i].designRegionLength();
+        }
+
+        int paddedDesignRegionLength(long long i) {
+            LibrarySequence& librarySequence = this->librarySequnces[i];
+            return librarySequence.fivePrimePadding.size() + this->designRegionLength(i) + librarySequence.threePrimePadding.size();
+        }
+
+        int sequenceLength(long long i) {
+            return this->librarySequnces[i].length() - this->librarySequnces[i].designRegionLength() + this->designRegionLength(i);
+        }
+
+        void appendDesignRegion(long long i, std::string& buffer) {
+            if (this->designRegionsArePacked) {
+                this->packedDesignRegions[i].appendTo(buffer);
+            } else {
+                buffer += this->librarySequnces[i].designRegion;
+            }
         }
 
 
         int barcodeDiscrepancy() {
-            return this->librarySequnces.size() - this->barcodes.size();
+            return this->librarySequnces.size() + this->existingBarcodeCount - this->barcodes.size();
         }
 
         int lengthDiscrepancy(int length) {
-            int n = 0;
-            for (LibrarySequence librarySequence : *this) {
-                if (librarySequence.length() != length) {
-                    n++;
+            return parallelReduce(this->size(), 0, [&](long long begin, long long end) {
+                int n = 0;
+                for (long long i = begin; i < end; i++) {
+                    if (this->sequenceLength(i) != length) {
+                        n++;
+                    }
                 }
+                return n;
+            }, std::plus<int>());
+        }
+
+
+        // the indices of every sequence in the library, in order
+        std::vector<long long> allIndices() {
+            std::vector<long long> indices(this->size());
+            for (long long i = 0; i < this->size(); i++) {
+                indices[i] = i;
             }
-            return n;
+            return indices;
         }
 
 
         void writeToCSV(std::string filename) {
-            std::ofstream file(filename);
-            file << "Name,5' Constant Region,5' Padding,Design Region,3' Padding,Barcode,3' Constant Region\n";
-            for (LibrarySequence librarySequence : *this) {
-                file << librarySequence.name << "," << librarySequence.fivePrimeConstantRegion << "," << librarySequence.fivePrimePadding << "," << librarySequence.designRegion << "," << librarySequence.threePrimePadding << "," << librarySequence.barcode << "," << librarySequence.threePrimeConstantRegion << "\n";
-            }
-            file.close();
+            this->writeToCSV(filename, this->allIndices());
+        }
+
+        // write the sequences at the given indices as CSV, or append them to
+        // an existing CSV, without a header
+        void writeToCSV(std::string filename, const std::vector<long long>& indices, bool append = false) {
+            writeRecordsInParallel(
+                filename,
+                append ? "" : "Name,5' Constant Region,5' Padding,Design Region,3' Padding,Barcode,3' Constant Region\n",
+                indices.size(),
+                [&](long long i) {
+                    LibrarySequence& librarySequence = this->librarySequnces[indices[i]];
+                    return (long long) librarySequence.name.size() + this->sequenceLength(indices[i]) + 7;
+                },
+                [&](long long i, std::string& buffer) {
+                    LibrarySequence& librarySequence = this->librarySequnces[indices[i]];
+                    buffer += librarySequence.name;
+                    buffer += ',';
+                    buffer += librarySequence.fivePrimeConstantRegion;
+                    buffer += ',';
+                    buffer += librarySequence.fivePrimePadding;
+                    buffer += ',';
+                    this->appendDesignRegion(indices[i], buffer);
+                    buffer += ',';
+                    buffer += librarySequence.threePrimePadding;
+                    buffer += ',';
+                    buffer += librarySequence.barcode;
+                    buffer += ',';
+                    buffer += librarySequence.threePrimeConstantRegion;
+                    buffer += '\n';
+                },
+                append
+            );
         }
 
 
@@ -427,39 +1407,111 @@ class Library {
 
 
         void writeToFasta(std::string filename) {
-            std::ofstream file(filename);
-            for (LibrarySequence librarySequence : *this) {
+            this->writeToFasta(filename, this->allIndices());
+        }
+
+        // write the sequences at the given indices as FASTA, or append them to
+        // an existing FASTA file
+        void writeToFasta(std::string filename, const std::vector<long long>& indices, bool append = false) {
+            writeRecordsInParallel(
+                filename,
+                "",
+                indices.size(),
+                [&](long long i) {
+                    LibrarySequence& librarySequence = this->librarySequnces[indices[i]];
+                    return (long long) (librarySequence.name[0] != '>') + librarySequence.name.size() + this->sequenceLength(indices[i]) + 2;
+                },
+                [&](long long i, std::string& buffer) {
+                    LibrarySequence& librarySequence = this->librarySequnces[indices[i]];
+
+                    // if the name does not start with a >, add it, otherwise, write
+                    // the name as is, since it is already in fasta format
+                    if (librarySequence.name[0] != '>') {
+                        buffer += '>';
+                    }
+                    buffer += librarySequence.name;
+                    buffer += '\n';
+                    buffer += librarySequence.fivePrimeConstantRegion;
+                    buffer += librarySequence.fivePrimePadding;
+                    this->appendDesignRegion(indices[i], buffer);
+                    buffer += librarySequence.threePrimePadding;
+                    buffer += librarySequence.barcode;
+                    buffer += librarySequence.threePrimeConstantRegion;
+                    buffer += '\n';
+                },
+                append
+            );
+        }
+
+
+        // split the library into shards for writing to separate files. By
+        // default the library is split into numShards contiguous shards of
+        // nearly equal size; if bySublibrary is set, there is instead one shard
+        // per sublibrary, in the order the sublibraries first appear.
+        std::vector<LibraryShard> shard(int numShards, bool bySublibrary, char sublibraryDelimiter) {
+            std::vector<LibraryShard> shards;
+            if (bySublibrary) {
+                std::unordered_map<std::string, int> shardIndices;
+                for (long long i = 0; i < this->size(); i++) {
+                    std::string sublibrary = this->librarySequnces[i].sublibrary(sublibraryDelimiter);
+                    auto found = shardIndices.find(sublibrary);
+                    if (found == shardIndices.end()) {
+                        found = shardIndices.insert({sublibrary, (int) shards.size()}).first;
+                        shards.push_back({sublibrary, {}});
+                    }
+                    shards[found->second].indices.push_back(i);
+                }
+                return shards;
+            }
 
-                // if the name does not start with a >, add it, otherwise, write
-                // the name as is, since it is already in fasta format
-                if (librarySequence.name[0] != '>') {
-                    file << ">";
+            numShards = std::max(1, numShards);
+            for (int shard = 0; shard < numShards; shard++) {
+                long long begin = shard * this->size() / numShards;
+                long long end = (shard + 1) * this->size() / numShards;
+                shards.push_back({std::to_string(shard + 1), {}});
+                for (long long i = begin; i < end; i++) {
+                    shards.back().indices.push_back(i);
                 }
-                file << librarySequence.name << "\n";
-                file << librarySequence.toString() << "\n";
             }
-            file.close();
+            return shards;
         }
 
 
         void toDNA() {
-            for (LibrarySequence& librarySequence : *this) {
-                librarySequence.toDNA();
-            }
+            parallelFor(this->size(), [&](long long begin, long long end, int thread) {
+                for (long long i = begin; i < end; i++) {
+                    this->librarySequnces[i].toDNA();
+                    if (this->designRegionsArePacked) {
+                        this->packedDesignRegions[i].toDNA();
+                    }
+                }
+            });
         }
 
 
         void toRNA() {
-            for (LibrarySequence& librarySequence : *this) {
-                librarySequence.toRNA();
-            }
+            parallelFor(this->size(), [&](long long begin, long long end, int thread) {
+                for (long long i = begin; i < end; i++) {
+                    this->librarySequnces[i].toRNA();
+                    if (this->designRegionsArePacked) {
+                        this->packedDesignRegions[i].toRNA();
+                    }
+                }
+            });
         }
 
 
+        // check the sequences in parallel, and report the invalid ones in order
         void verifyIsValidNucleicAcid() {
-            for (LibrarySequence librarySequence : *this) {
-                if (!librarySequence.verifyIsValidNucleicAcid()) {
-                    std::cout << "Error: " << librarySequence.toSeparatedString() << " is not a DNA sequence.\n";
+            std::vector<char> valid(this->size());
+            parallelFor(this->size(), [&](long long begin, long long end, int thread) {
+                for (long long i = begin; i < end; i++) {
+                    valid[i] = this->librarySequnces[i].verifyIsValidNucleicAcid();
+                }
+            });
+            for (long long i = 0; i < this->size(); i++) {
+                if (!valid[i]) {
+                    std::cout << "Error: " << this->librarySequnces[i].toSeparatedString() << " is not a DNA sequence.\n";
                 }
             }
         }
@@ -2,6 +2,7 @@
 
 #include <argparse/argparse.hpp>
 #include "library.h"
+#include "demux.h"
 
 using std::string;
 
@@ -34,6 +35,97 @@ int main(int argc, char** argv) {
 		.default_value(16)		
 		.scan<'d', int>();
 
+	program.add_argument("--metrics")
+		.default_value("");
+
+	program.add_argument("--foldCheck")
+		.default_value("off");
+	program.add_argument("--foldContext")
+		.default_value(12)
+		.scan<'d', int>();
+
+	program.add_argument("--closingPairs")
+		.default_value("");
+
+	program.add_argument("--minGC")
+		.default_value(0.0)
+		.scan<'g', double>();
+	program.add_argument("--maxGC")
+		.default_value(1.0)
+		.scan<'g', double>();
+	program.add_argument("--gcWindow")
+		.default_value(0)
+		.scan<'d', int>();
+	program.add_argument("--maxHomopolymer")
+		.default_value(0)
+		.scan<'d', int>();
+	program.add_argument("--forbiddenMotifs")
+		.default_value("");
+
+	program.add_argument("--kmerScreen")
+		.default_value(0)
+		.scan<'d', int>();
+
+	program.add_argument("--hybridizationRadius")
+		.default_value(-1)
+		.scan<'d', int>();
+
+	program.add_argument("--minEditDistance")
+		.default_value(0)
+		.scan<'d', int>();
+
+	program.add_argument("--auditDistance")
+		.default_value(0)
+		.scan<'d', int>();
+	program.add_argument("--auditFix")
+		.default_value(false)
+		.implicit_value(true);
+
+	program.add_argument("--nearDuplicateThreshold")
+		.default_value(0.0)
+		.scan<'g', double>();
+	program.add_argument("--maxPerCluster")
+		.default_value(0)
+		.scan<'d', int>();
+	program.add_argument("--nearDuplicateK")
+		.default_value(8)
+		.scan<'d', int>();
+
+	program.add_argument("--statistics")
+		.default_value("");
+
+	program.add_argument("--append")
+		.default_value("");
+
+	program.add_argument("--shards")
+		.default_value(1)
+		.scan<'d', int>();
+	program.add_argument("--shardBySublibrary")
+		.default_value(false)
+		.implicit_value(true);
+	program.add_argument("--sublibraryDelimiter")
+		.default_value("_");
+
+	program.add_argument("--demux")
+		.default_value("");
+	program.add_argument("--barcodeOffset")
+		.scan<'d', int>();
+	program.add_argument("--counts")
+		.default_value("counts.csv");
+
+	program.add_argument("--packedStorage")
+		.default_value(false)
+		.implicit_value(true);
+
+	program.add_argument("--registry")
+		.default_value("");
+	program.add_argument("--serveRegistry")
+		.default_value("");
+
+	program.add_argument("--threads")
+		.default_value(NUM_THREADS)
+		.scan<'d', int>();
+
 	try {
 	  program.parse_args(argc, argv);
 	}
@@ -56,6 +148,82 @@ int main(int argc, char** argv) {
 	int minStemLength = program.get<int>("--minStemLength");
 	int maxStemLength = program.get<int>("--maxStemLength");
 
+	string metricsFilename = program.get<string>("--metrics");
+
+	string foldCheck = program.get<string>("--foldCheck");
+	int foldContext = program.get<int>("--foldContext");
+
+	string closingPairs = program.get<string>("--closingPairs");
+
+	double minGC = program.get<double>("--minGC");
+	double maxGC = program.get<double>("--maxGC");
+	int gcWindow = program.get<int>("--gcWindow");
+	int maxHomopolymer = program.get<int>("--maxHomopolymer");
+	string forbiddenMotifs = program.get<string>("--forbiddenMotifs");
+
+	int kmerScreen = program.get<int>("--kmerScreen");
+	int hybridizationRadius = program.get<int>("--hybridizationRadius");
+	int minEditDistance = program.get<int>("--minEditDistance");
+	int auditDistance = program.get<int>("--auditDistance");
+	bool auditFix = program.get<bool>("--auditFix");
+
+	double nearDuplicateThreshold = program.get<double>("--nearDuplicateThreshold");
+	int maxPerCluster = program.get<int>("--maxPerCluster");
+	int nearDuplicateK = program.get<int>("--nearDuplicateK");
+	string statisticsFilename = program.get<string>("--statistics");
+	string appendFilename = program.get<string>("--append");
+	int numShards = program.get<int>("--shards");
+	bool shardBySublibrary = program.get<bool>("--shardBySublibrary");
+	string sublibraryDelimiter = program.get<string>("--sublibraryDelimiter");
+
+	NUM_THREADS = std::max(1, program.get<int>("--threads"));
+
+	if (foldCheck != "off" && foldCheck != "flag" && foldCheck != "regenerate") {
+	  std::cerr << "--foldCheck must be one of off, flag or regenerate." << std::endl;
+	  std::exit(1);
+	}
+
+	string demuxFilename = program.get<string>("--demux");
+	string countsFilename = program.get<string>("--counts");
+
+	bool packedStorage = program.get<bool>("--packedStorage");
+
+	string registrySocket = program.get<string>("--registry");
+	string serveRegistrySocket = program.get<string>("--serveRegistry");
+
+
+    // in registry server mode, the input is the write-ahead log of the
+    // registry, which is replayed and then served until the process is stopped
+    if (!serveRegistrySocket.empty()) {
+        BarcodeRegistry registry = BarcodeRegistry(filename);
+        serveBarcodeRegistry(serveRegistrySocket, registry);
+        return 0;
+    }
+
+
+    // in demux mode, the input is a designed library, and reads from the
+    // given FASTQ file are counted against its barcodes
+    if (!demuxFilename.empty()) {
+        METRICS.startStage("load barcodes");
+        BarcodeDemultiplexer demultiplexer = BarcodeDemultiplexer(filename);
+        if (program.is_used("--barcodeOffset")) {
+            demultiplexer.offset = program.get<int>("--barcodeOffset");
+        }
+        METRICS.endStage(demultiplexer.barcodes.size());
+
+        std::cout << "Loaded " << demultiplexer.barcodes.size() << " barcodes of length " << demultiplexer.barcodeLength << "." << std::endl;
+        std::cout << "----------------------" << std::endl;
+
+        METRICS.startStage("demux");
+        long long numReads = demultiplexer.run(demuxFilename, countsFilename);
+        METRICS.endStage(numReads);
+
+        if (!metricsFilename.empty()) {
+            METRICS.writeJSON(metricsFilename);
+        }
+        return 0;
+    }
+
 
     // set the final desired length of the sequences
     int finalLength = 170;
@@ -64,38 +232,148 @@ int main(int argc, char** argv) {
     std::vector<int> maxBasePairCounts = {barcodeLength, 5, 1};
 
     // create a library object
+    METRICS.startStage("read");
     Library library = Library(
         filename,
         barcodeStemLoop
         );
+    METRICS.endStage(library.size());
     
+    // set the constraints on generated barcodes and padding
+    std::vector<std::string> motifs;
+    for (std::string motif : splitByDelimiter(forbiddenMotifs, ',')) {
+        if (!motif.empty()) {
+            motifs.push_back(motif);
+        }
+    }
+    library.constraints = SequenceConstraints(minGC, maxGC, gcWindow, maxHomopolymer, motifs);
+
+    // restrict the outermost base pair of every barcode stem, if requested
+    if (!closingPairs.empty()) {
+        library.allowedBarcodePairs = std::vector<uint8_t>(barcodeLength, 0x3f);
+        library.allowedBarcodePairs.back() = parseBasePairMask(closingPairs);
+    }
+
+    // claim barcodes from a shared registry, if one is given, so that they
+    // stay apart from those of the other libraries designed against it
+    if (!registrySocket.empty()) {
+        library.registry = BarcodeRegistryClient(registrySocket, barcodeStemLoop.size());
+        std::cout << "Connected to the barcode registry at " << registrySocket << ", which holds " << library.registry.count() << " barcodes." << std::endl;
+    }
+
     // print the length of the library
     std::cout << "Number of records: " << library.size() << std::endl;
     std::cout << "----------------------" << std::endl;
 
     // verify that all sequences are valid nucleic acid sequences
+    METRICS.startStage("verify");
     library.verifyIsValidNucleicAcid();
+    METRICS.endStage(library.size());
+
+    // in append mode, the design regions of the existing library are
+    // clustered and indexed together with the new ones
+    std::vector<std::string> existingDesignRegions;
+    if (!appendFilename.empty()) {
+        existingDesignRegions = readDesignRegions(appendFilename);
+    }
+
+    // cluster near-duplicate designs, such as single mutants of the same
+    // scaffold, and cap the size of each cluster if requested
+    if (nearDuplicateThreshold > 0) {
+        METRICS.startStage("near duplicates");
+        long long numSequences = library.size();
+        library.capNearDuplicates(nearDuplicateThreshold, maxPerCluster, nearDuplicateK, existingDesignRegions);
+        METRICS.endStage(numSequences);
+        std::cout << "----------------------" << std::endl;
+    }
+
+    // in append mode, load the barcodes of the existing library, from their
+    // cache if the library has not changed since it was written, so that only
+    // the new sequences need to be processed
+    BarcodeCache existingBarcodes = BarcodeCache(appendFilename);
+    if (!appendFilename.empty()) {
+        METRICS.startStage("load existing");
+        existingBarcodes.load();
+        library.addExistingBarcodes(existingBarcodes.barcodes);
+        METRICS.endStage(existingBarcodes.barcodes.size());
+
+        std::cout << "Read the barcodes of " << appendFilename << " from " << (existingBarcodes.loadedFromCache ? "its cache." : "the library.") << std::endl;
+        std::cout << "----------------------" << std::endl;
+    }
+
+    // index the k-mers of the design and constant regions, so that barcodes
+    // and padding can be kept out of them. When appending, the design regions
+    // of the existing library are indexed too.
+    if (kmerScreen > 0) {
+        METRICS.startStage("index");
+        std::vector<std::string> otherRegions = {fivePrimeConstantRegion, threePrimeConstantRegion};
+        otherRegions.insert(otherRegions.end(), existingDesignRegions.begin(), existingDesignRegions.end());
+        library.buildKmerIndex(kmerScreen, otherRegions);
+        METRICS.endStage(library.size());
+
+        std::cout << "Indexed " << library.designKmers.size() << " distinct " << kmerScreen << "-mers of the design and constant regions." << std::endl;
+        std::cout << "----------------------" << std::endl;
+    }
+
+    // index the existing barcodes and the constant regions, so that barcodes
+    // that could pair with them can be rejected
+    if (hybridizationRadius >= 0) {
+        METRICS.startStage("hybridization index");
+        library.buildHybridizationScreen(barcodeLength, hybridizationRadius, {fivePrimeConstantRegion, threePrimeConstantRegion});
+        METRICS.endStage(library.barcodes.size());
+    }
+
+    // index the existing barcodes, so that new barcodes can be kept apart
+    // from them by insertions and deletions as well as substitutions
+    if (minEditDistance > 1) {
+        METRICS.startStage("edit distance index");
+        library.buildEditDistanceIndex(barcodeLength, minEditDistance);
+        METRICS.endStage(library.barcodes.size());
+    }
+
+    // keep the design regions at two bits per base from here on, now that
+    // they have been indexed, if requested
+    if (packedStorage) {
+        METRICS.startStage("pack");
+        library.packDesignRegions();
+        METRICS.endStage(library.size());
+    }
 
     // add padding to the five prime end of the barcode
+    METRICS.startStage("pad");
     library.padAllToLengthOnFivePrimeEnd(
         padToLength,
         minStemLength,
         maxStemLength,
         maxBasePairCounts
         );
+    METRICS.endStage(library.size());
 
     std::cout << "All sequences are padded to a length of " << padToLength << " nt." << std::endl;
     std::cout << "----------------------" << std::endl;
 
     // add barcodes to the library
+    METRICS.startStage("barcode");
     library.barcode(
         barcodeLength,
         maxBasePairCounts
         );
+    METRICS.endStage(METRICS.barcodesAccepted.load());
 
     std::cout << "----------------------" << std::endl;
 
+    // audit every barcode, including those read from the input and those of
+    // the existing library when appending, for pairs that are closer than the
+    // requested distance
+    if (auditDistance > 0) {
+        METRICS.startStage("audit");
+        library.auditBarcodes(auditDistance, auditFix, barcodeLength, maxBasePairCounts, existingBarcodes.barcodes);
+        METRICS.endStage(library.barcodes.size());
+        std::cout << "----------------------" << std::endl;
+    }
+
     // remove the null barcode
+    METRICS.startStage("finalize");
     std::string nullBarcode = "N";
     int numBarcodesRemoved = library.removeBarcode(nullBarcode);
 
@@ -106,8 +384,45 @@ int main(int argc, char** argv) {
     library.replaceFivePrimeConstantRegion(fivePrimeConstantRegion);
     library.replaceThreePrimeConstantRegion(threePrimeConstantRegion);
 
-    // print the length discrepancy
-    int lengthDiscrepancy = library.lengthDiscrepancy(finalLength);
+    // check the sequence constraints across the junctions between the parts
+    // of every construct, now that they are complete
+    if (library.constraints.isEnabled()) {
+        int numFailing = library.checkJunctions(
+            barcodeLength,
+            minStemLength,
+            maxStemLength,
+            maxBasePairCounts
+            );
+
+        std::cout << "There are " << numFailing << " sequences with junctions between their parts that break the sequence constraints." << std::endl;
+        std::cout << "----------------------" << std::endl;
+    }
+    METRICS.endStage(library.size());
+
+    // check that the padding stems and barcodes fold as intended, now that
+    // the constructs are complete
+    if (foldCheck != "off") {
+        METRICS.startStage("fold");
+        library.unpackDesignRegions();
+        int numMisfolded = library.checkFolding(
+            foldContext,
+            foldCheck == "regenerate",
+            barcodeLength,
+            minStemLength,
+            maxStemLength,
+            maxBasePairCounts
+            );
+        METRICS.endStage(library.size());
+
+        std::cout << "There are " << numMisfolded << " sequences whose padding or barcode is not predicted to fold as intended." << std::endl;
+        std::cout << "----------------------" << std::endl;
+    }
+
+    // compute the statistics of the library in one pass, and print the
+    // length discrepancy from them
+    METRICS.startStage("statistics");
+    SequenceStatistics statistics = library.statistics();
+    long long lengthDiscrepancy = statistics.lengthDiscrepancy(finalLength);
     std::cout << "There are " << lengthDiscrepancy << " sequences that are not of the correct length, which is " << finalLength << std::endl;
     std::cout << "----------------------" << std::endl;
 
@@ -118,10 +433,52 @@ int main(int argc, char** argv) {
 
     // convert to DNA
     library.toDNA();
+    METRICS.endStage(library.size());
 
     // write the library to a csv and a fasta file
-    library.writeToCSV("output.csv");
-    library.writeToFasta("output.fasta");
+    METRICS.startStage("write");
+    if (!appendFilename.empty()) {
+
+        // append to the existing csv and fasta files, and update the cache of
+        // their barcodes
+        std::string appendFastaFilename = appendFilename;
+        if (appendFastaFilename.size() > 4 && appendFastaFilename.substr(appendFastaFilename.size() - 4) == ".csv") {
+            appendFastaFilename.resize(appendFastaFilename.size() - 4);
+        }
+        appendFastaFilename += ".fasta";
+        library.writeToCSV(appendFilename, library.allIndices(), true);
+        library.writeToFasta(appendFastaFilename, library.allIndices(), true);
+
+        std::vector<std::string> newBarcodes;
+        for (LibrarySequence& librarySequence : library) {
+            newBarcodes.push_back(librarySequence.barcode);
+        }
+        existingBarcodes.append(newBarcodes);
+        std::cout << "Appended " << library.size() << " sequences to " << appendFilename << " and " << appendFastaFilename << "." << std::endl;
+    } else if (numShards <= 1 && !shardBySublibrary) {
+        library.writeToCSV("output.csv");
+        library.writeToFasta("output.fasta");
+    } else {
+
+        // write each shard to its own pair of files
+        std::vector<LibraryShard> shards = library.shard(numShards, shardBySublibrary, sublibraryDelimiter.empty() ? '_' : sublibraryDelimiter[0]);
+        for (LibraryShard& shard : shards) {
+            library.writeToCSV("output_" + shard.name + ".csv", shard.indices);
+            library.writeToFasta("output_" + shard.name + ".fasta", shard.indices);
+        }
+        std::cout << "Wrote the library in " << shards.size() << " shards." << std::endl;
+    }
+    METRICS.endStage(library.size());
+
+    // write the statistics of the library, if requested
+    if (!statisticsFilename.empty()) {
+        statistics.writeJSON(statisticsFilename);
+    }
+
+    // write the metrics, if requested
+    if (!metricsFilename.empty()) {
+        METRICS.writeJSON(metricsFilename);
+    }
 
     return 0;
     
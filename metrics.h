@@ -0,0 +1,145 @@
+// metrics.h
+
+#include <atomic>
+#include <chrono>
+#include <ctime>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <vector>
+#include <sys/resource.h>
+
+
+// the timing of a single stage of the pipeline
+typedef struct {
+    std::string name;
+    double wallSeconds;
+    double cpuSeconds;
+    long long items;
+} StageMetrics;
+
+
+// get the peak resident set size of the process in kilobytes
+long peakResidentSetSize() {
+    struct rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+    return usage.ru_maxrss;
+}
+
+
+class Metrics {
+    public:
+        std::vector<StageMetrics> stages;
+
+        // hot-path counters, which are atomic so that they may be incremented
+        // from worker threads
+        std::atomic<long long> barcodesAccepted{0};
+        std::atomic<long long> barcodeRejections{0};
+        std::atomic<long long> maxRejectionsForOneBarcode{0};
+        std::atomic<long long> indexProbes{0};
+        std::atomic<long long> rehashEvents{0};
+        std::atomic<long long> foldChecks{0};
+        std::atomic<long long> foldFailures{0};
+        std::atomic<long long> constraintPrunes{0};
+        std::atomic<long long> kmerScreenRejections{0};
+        std::atomic<long long> hybridizationRejections{0};
+        std::atomic<long long> editDistanceRejections{0};
+        std::atomic<long long> auditConflicts{0};
+        std::atomic<long long> registryRequests{0};
+        std::atomic<long long> registryRejections{0};
+
+        // the state of the barcode hash set at the end of barcoding
+        double barcodeSetLoadFactor = 0;
+        long long barcodeSetBucketCount = 0;
+
+        // begin timing a stage of the pipeline
+        void startStage(std::string name) {
+            this->currentStage = name;
+            this->wallStart = std::chrono::steady_clock::now();
+            this->cpuStart = std::clock();
+        }
+
+        // finish timing the current stage, recording the number of items it
+        // processed so that the throughput can be reported
+        void endStage(long long items) {
+            std::chrono::duration<double> wall = std::chrono::steady_clock::now() - this->wallStart;
+            double cpu = (double) (std::clock() - this->cpuStart) / CLOCKS_PER_SEC;
+            this->stages.push_back({this->currentStage, wall.count(), cpu, items});
+        }
+
+        // record the number of candidates that were rejected before a barcode
+        // was accepted
+        void recordBarcode(long long rejections) {
+            this->barcodesAccepted.fetch_add(1, std::memory_order_relaxed);
+            this->barcodeRejections.fetch_add(rejections, std::memory_order_relaxed);
+            long long previous = this->maxRejectionsForOneBarcode.load(std::memory_order_relaxed);
+            while (rejections > previous && !this->maxRejectionsForOneBarcode.compare_exchange_weak(previous, rejections)) {}
+        }
+
+        std::string toJSON() {
+            std::ostringstream json;
+            json << "{\n  \"stages\": [\n";
+            for (int i = 0; i < this->stages.size(); i++) {
+                StageMetrics& stage = this->stages[i];
+                double throughput = stage.wallSeconds > 0 ? stage.items / stage.wallSeconds : 0;
+                double cpuUtilisation = stage.wallSeconds > 0 ? stage.cpuSeconds / stage.wallSeconds : 0;
+                json << "    {\"name\": \"" << stage.name << "\""
+                     << ", \"wall_seconds\": " << stage.wallSeconds
+                     << ", \"cpu_seconds\": " << stage.cpuSeconds
+                     << ", \"cpu_utilisation\": " << cpuUtilisation
+                     << ", \"items\": " << stage.items
+                     << ", \"items_per_second\": " << throughput << "}";
+                json << (i + 1 < this->stages.size() ? ",\n" : "\n");
+            }
+            json << "  ],\n";
+
+            long long accepted = this->barcodesAccepted.load();
+            long long rejections = this->barcodeRejections.load();
+            json << "  \"counters\": {\n";
+            json << "    \"barcodes_accepted\": " << accepted << ",\n";
+            json << "    \"barcode_rejections\": " << rejections << ",\n";
+            json << "    \"rejections_per_barcode\": " << (accepted > 0 ? (double) rejections / accepted : 0) << ",\n";
+            json << "    \"max_rejections_for_one_barcode\": " << this->maxRejectionsForOneBarcode.load() << ",\n";
+            json << "    \"index_probes\": " << this->indexProbes.load() << ",\n";
+            json << "    \"rehash_events\": " << this->rehashEvents.load() << ",\n";
+            json << "    \"fold_checks\": " << this->foldChecks.load() << ",\n";
+            json << "    \"fold_failures\": " << this->foldFailures.load() << ",\n";
+            json << "    \"constraint_prunes\": " << this->constraintPrunes.load() << ",\n";
+            json << "    \"kmer_screen_rejections\": " << this->kmerScreenRejections.load() << ",\n";
+            json << "    \"hybridization_rejections\": " << this->hybridizationRejections.load() << ",\n";
+            json << "    \"edit_distance_rejections\": " << this->editDistanceRejections.load() << ",\n";
+            json << "    \"audit_conflicts\": " << this->auditConflicts.load() << ",\n";
+            json << "    \"registry_requests\": " << this->registryRequests.load() << ",\n";
+            json << "    \"registry_rejections\": " << this->registryRejections.load() << ",\n";
+            json << "    \"barcode_set_load_factor\": " << this->barcodeSetLoadFactor << ",\n";
+            json << "    \"barcode_set_bucket_count\": " << this->barcodeSetBucketCount << "\n";
+            json << "  },\n";
+            json << "  \"peak_rss_kb\": " << peakResidentSetSize() << "\n";
+            json << "}\n";
+            return json.str();
+        }
+
+        // write the metrics as JSON to a file, or to stdout if the filename is "-"
+        void writeJSON(std::string filename) {
+            if (filename == "-") {
+                std::cout << this->toJSON();
+                return;
+            }
+            std::ofstream file(filename);
+            if (!file.is_open()) {
+                std::cerr << "Unable to open file: " << filename << std::endl;
+                return;
+            }
+            file << this->toJSON();
+        }
+
+    private:
+        std::string currentStage;
+        std::chrono::steady_clock::time_point wallStart;
+        std::clock_t cpuStart;
+};
+
+
+// the process-wide metrics, which every stage and hot path reports to
+Metrics METRICS;
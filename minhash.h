@@ -0,0 +1,212 @@
+// minhash.h
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <numeric>
+#include <string>
+#include <vector>
+
+
+// a one-permutation MinHash sketch of the k-mers of a sequence. The hash of
+// every k-mer picks one of numBins bins and keeps the minimum of the rest of
+// its bits in that bin, so a sketch costs one hash per k-mer however many bins
+// it has. Empty bins borrow the value of the next full bin. The fraction of
+// bins two sketches share estimates the Jaccard similarity of their k-mers.
+// Only the high 16 bits of each minimum are kept, which makes the estimate high
+// by at most 1 / 65536.
+class MinHashSketcher {
+    public:
+        int k;
+        int numBins;
+
+        MinHashSketcher(int k = 8, int numBins = 64) {
+            this->k = std::max(1, std::min(k, KMER_MAX_LENGTH));
+            this->numBins = numBins;
+        }
+
+        // write the sketch of a sequence to sketch, which holds numBins values
+        void sketch(const std::string& sequence, uint16_t* sketch) const {
+            std::vector<uint64_t> minimums(this->numBins, UINT64_MAX);
+            forEachKmer(sequence, this->k, false, [&](uint64_t kmer) {
+                uint64_t hash = packedHash(kmer + 1);
+                uint64_t bin = ((unsigned __int128) hash * this->numBins) >> 64;
+                minimums[bin] = std::min(minimums[bin], hash * this->numBins);
+            });
+
+            // fill each empty bin from the next full one, offset by the bin so
+            // that borrowed values rarely collide by chance
+            int full = -1;
+            for (int bin = 0; bin < this->numBins; bin++) {
+                if (minimums[bin] != UINT64_MAX) {
+                    full = bin;
+                    break;
+                }
+            }
+            for (int bin = 0; bin < this->numBins; bin++) {
+                uint64_t value = minimums[bin];
+                if (full < 0) {
+                    value = 0;
+                } else if (value == UINT64_MAX) {
+                    int next = bin;
+                    while (minimums[next] == UINT64_MAX) {
+                        next = (next + 1) % this->numBins;
+                    }
+                    value = packedHash(minimums[next] + bin);
+                }
+                sketch[bin] = value >> 48;
+            }
+        }
+};
+
+
+// the fraction of bins at which two sketches agree
+double sketchSimilarity(const uint16_t* a, const uint16_t* b, int numBins) {
+    int shared = 0;
+    for (int bin = 0; bin < numBins; bin++) {
+        shared += a[bin] == b[bin];
+    }
+    return (double) shared / numBins;
+}
+
+
+// a union-find forest over the indices of a collection
+class DisjointSets {
+    public:
+        DisjointSets(long long n) {
+            this->parents.resize(n);
+            std::iota(this->parents.begin(), this->parents.end(), 0);
+        }
+
+        long long find(long long i) {
+            while (this->parents[i] != i) {
+                this->parents[i] = this->parents[this->parents[i]];
+                i = this->parents[i];
+            }
+            return i;
+        }
+
+        // join the sets of two indices, keeping the smaller root, so that
+        // every set is represented by its first index
+        void join(long long a, long long b) {
+            a = this->find(a);
+            b = this->find(b);
+            if (a != b) {
+                this->parents[std::max(a, b)] = std::min(a, b);
+            }
+        }
+
+    private:
+        std::vector<long long> parents;
+};
+
+
+// the most memory that the buckets of the bands sorted at the same time by
+// clusterNearDuplicates may take, which bounds how many are sorted at once
+const long long NEAR_DUPLICATE_BUCKET_BYTES = 1LL << 30;
+
+
+// cluster sequences whose k-mers have an estimated Jaccard similarity of at
+// least threshold, and return the cluster of every sequence, which is the
+// index of its first member. Sketches are computed in parallel, and are split
+// into bands of rows, with the number of rows chosen so that pairs at the
+// threshold are very likely to share a band. Sequences that share a band are
+// candidates, and each candidate is compared only with the first sequence of
+// its bucket, so the work is near-linear in the number of sequences rather
+// than quadratic. Sequences join a cluster through a chain of similar pairs.
+std::vector<long long> clusterNearDuplicates(
+    long long n,
+    std::function<const std::string&(long long)> sequenceOf,
+    double threshold,
+    int k = 8,
+    int numBins = 64
+    ) {
+    MinHashSketcher sketcher = MinHashSketcher(k, numBins);
+    std::vector<uint16_t> sketches(n * numBins);
+    parallelFor(n, [&](long long begin, long long end, int thread) {
+        for (long long i = begin; i < end; i++) {
+            sketcher.sketch(sequenceOf(i), &sketches[i * numBins]);
+        }
+    });
+
+    // choose the number of rows per band: a pair of similarity s shares at
+    // least one of b bands of r rows with probability 1 - (1 - s^r)^b, which
+    // should be high at the threshold
+    int rows = 1;
+    for (int candidate = 1; candidate <= numBins; candidate++) {
+        int bands = numBins / candidate;
+        if (1 - std::pow(1 - std::pow(threshold, candidate), bands) < 0.99) {
+            break;
+        }
+        rows = candidate;
+    }
+    int numBands = numBins / rows;
+
+    // find the candidate pairs of each band, and keep those that are similar.
+    // Bands are sorted a batch at a time, each into a bucket buffer that is
+    // reused by the band at the same place in the next batch, with no more
+    // bands to a batch than fit in NEAR_DUPLICATE_BUCKET_BYTES
+    long long bucketBytes = std::max<long long>(1, n) * sizeof(std::pair<uint64_t, long long>);
+    int batchSize = std::max<long long>(1, std::min<long long>({NUM_THREADS, numBands, NEAR_DUPLICATE_BUCKET_BYTES / bucketBytes}));
+    std::vector<std::vector<std::pair<uint64_t, long long> > > bucketBuffers(batchSize);
+    std::vector<std::vector<std::pair<long long, long long> > > edges(numBands);
+    for (int batch = 0; batch < numBands; batch += batchSize) {
+        int batchEnd = std::min(numBands, batch + batchSize);
+        parallelFor(batchEnd - batch, [&](long long begin, long long end, int thread) {
+            for (int band = batch + begin; band < batch + end; band++) {
+                std::vector<std::pair<uint64_t, long long> >& buckets = bucketBuffers[band - batch];
+                buckets.resize(n);
+                for (long long i = 0; i < n; i++) {
+                    uint64_t key = band;
+                    for (int row = 0; row < rows; row++) {
+                        key = packedHash(key * 65537 + sketches[i * numBins + band * rows + row]);
+                    }
+                    buckets[i] = {key, i};
+                }
+                std::sort(buckets.begin(), buckets.end());
+                for (long long first = 0, next = 0; first < n; first = next) {
+                    while (next < n && buckets[next].first == buckets[first].first) {
+                        next++;
+                    }
+                    const uint16_t* a = &sketches[buckets[first].second * numBins];
+                    for (long long j = first + 1; j < next; j++) {
+                        const uint16_t* b = &sketches[buckets[j].second * numBins];
+                        if (sketchSimilarity(a, b, numBins) >= threshold) {
+                            edges[band].push_back({buckets[first].second, buckets[j].second});
+                        }
+                    }
+                }
+            }
+        });
+    }
+
+    DisjointSets clusters = DisjointSets(n);
+    for (auto& bandEdges : edges) {
+        for (auto& edge : bandEdges) {
+            clusters.join(edge.first, edge.second);
+        }
+    }
+    std::vector<long long> labels(n);
+    for (long long i = 0; i < n; i++) {
+        labels[i] = clusters.find(i);
+    }
+    return labels;
+}
+
+
+// the indices of the sequences to keep so that no cluster has more than
+// maxPerCluster members, keeping the first members of each, and the number of
+// clusters with more than one member
+std::vector<long long> thinClusters(const std::vector<long long>& labels, int maxPerCluster, long long& numClusters) {
+    std::vector<long long> sizes(labels.size(), 0);
+    std::vector<long long> kept;
+    numClusters = 0;
+    for (long long i = 0; i < labels.size(); i++) {
+        long long size = ++sizes[labels[i]];
+        numClusters += size == 2;
+        if (maxPerCluster <= 0 || size <= maxPerCluster) {
+            kept.push_back(i);
+        }
+    }
+    return kept;
+}
@@ -0,0 +1,220 @@
+// output.h
+
+#include <atomic>
+#include <condition_variable>
+#include <functional>
+#include <deque>
+#include <iostream>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+#include <fcntl.h>
+#include <unistd.h>
+
+
+// write the whole of a buffer at the given offset, retrying short writes
+bool writeFully(int fd, const char* data, long long size, long long offset) {
+    while (size > 0) {
+        ssize_t written = pwrite(fd, data, size, offset);
+        if (written < 0) {
+            return false;
+        }
+        data += written;
+        size -= written;
+        offset += written;
+    }
+    return true;
+}
+
+
+// a file writer to which formatted buffers are handed off, so that the caller
+// can format the next buffer while the previous one is written. At most two
+// buffers are in flight at once, so that memory stays bounded. Writes are made
+// in order by a background thread, so that pipes may be written as well as
+// files.
+class AsyncFileWriter {
+    public:
+        AsyncFileWriter(std::string filename) {
+            this->fd = open(filename.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+            if (this->fd < 0) {
+                std::cerr << "Unable to open file: " << filename << std::endl;
+                return;
+            }
+            this->thread = std::thread(&AsyncFileWriter::run, this);
+        }
+
+        // write to a descriptor that is already open, which the writer closes
+        AsyncFileWriter(int fd) {
+            this->fd = fd;
+            if (this->fd >= 0) {
+                this->thread = std::thread(&AsyncFileWriter::run, this);
+            }
+        }
+
+        ~AsyncFileWriter() {
+            this->close();
+        }
+
+        bool isOpen() const {
+            return this->fd >= 0;
+        }
+
+        // hand the contents of buffer to the writer, leaving buffer empty but
+        // with the capacity of a previously written buffer where possible
+        void write(std::string& buffer) {
+            if (this->fd < 0 || buffer.empty()) {
+                buffer.clear();
+                return;
+            }
+            std::string recycled;
+            {
+                std::unique_lock<std::mutex> lock(this->mutex);
+                this->changed.wait(lock, [&]() {
+                    return this->pending.size() < AsyncFileWriter::MAX_IN_FLIGHT;
+                });
+                this->pending.push_back(std::string());
+                this->pending.back().swap(buffer);
+                recycled.swap(this->spare);
+            }
+            this->changed.notify_all();
+            buffer.swap(recycled);
+            buffer.clear();
+        }
+
+        // wait for every buffer to be written, and close the file
+        void close() {
+            if (this->fd < 0) {
+                return;
+            }
+            {
+                std::unique_lock<std::mutex> lock(this->mutex);
+                this->closing = true;
+            }
+            this->changed.notify_all();
+            this->thread.join();
+            ::close(this->fd);
+            this->fd = -1;
+        }
+
+    private:
+        static const int MAX_IN_FLIGHT = 2;
+
+        int fd = -1;
+
+        std::thread thread;
+        std::mutex mutex;
+        std::condition_variable changed;
+        std::deque<std::string> pending;
+        std::string spare;
+        bool closing = false;
+
+        // write queued buffers in order until the writer is closed
+        void run() {
+            while (true) {
+                std::string* buffer;
+                {
+                    std::unique_lock<std::mutex> lock(this->mutex);
+                    this->changed.wait(lock, [&]() {
+                        return !this->pending.empty() || this->closing;
+                    });
+                    if (this->pending.empty()) {
+                        return;
+                    }
+                    buffer = &this->pending.front();
+                }
+
+                for (long long written = 0; written < buffer->size(); ) {
+                    ssize_t result = ::write(this->fd, buffer->data() + written, buffer->size() - written);
+                    if (result < 0) {
+                        std::cerr << "Error: unable to write output." << std::endl;
+                        break;
+                    }
+                    written += result;
+                }
+
+                {
+                    std::unique_lock<std::mutex> lock(this->mutex);
+                    this->spare.swap(*buffer);
+                    this->pending.pop_front();
+                }
+                this->changed.notify_all();
+            }
+        }
+};
+
+
+// write n records to a file in parallel. The size of every record is known
+// before it is formatted, so the offset of each record is a prefix sum of the
+// sizes, and every thread formats its own range of records and writes them
+// with pwrite, independently of the others. Outputs that cannot be written
+// at an offset, such as pipes, are written through an AsyncFileWriter instead.
+// If append is set, the records are written after the existing contents of
+// the file.
+void writeRecordsInParallel(
+    std::string filename,
+    const std::string& header,
+    long long n,
+    std::function<long long(long long)> recordSize,
+    std::function<void(long long, std::string&)> format,
+    bool append = false
+    ) {
+    const long long flushSize = 1 << 22;
+
+    int fd = open(filename.c_str(), O_WRONLY | O_CREAT | (append ? 0 : O_TRUNC), 0644);
+    if (fd < 0) {
+        std::cerr << "Unable to open file: " << filename << std::endl;
+        return;
+    }
+    long long start = lseek(fd, 0, append ? SEEK_END : SEEK_CUR);
+    if (start < 0) {
+        AsyncFileWriter writer(fd);
+        std::string buffer = header;
+        for (long long i = 0; i < n; i++) {
+            format(i, buffer);
+            if (buffer.size() >= flushSize) {
+                writer.write(buffer);
+            }
+        }
+        writer.write(buffer);
+        return;
+    }
+
+    // the offset of every record
+    std::vector<long long> offsets(n + 1);
+    parallelFor(n, [&](long long begin, long long end, int thread) {
+        for (long long i = begin; i < end; i++) {
+            offsets[i + 1] = recordSize(i);
+        }
+    });
+    offsets[0] = start + header.size();
+    for (long long i = 0; i < n; i++) {
+        offsets[i + 1] += offsets[i];
+    }
+    if (ftruncate(fd, offsets[n]) < 0 || !writeFully(fd, header.data(), header.size(), start)) {
+        std::cerr << "Error: unable to write output." << std::endl;
+    }
+
+    std::atomic<bool> failed{false};
+    parallelFor(n, [&](long long begin, long long end, int thread) {
+        std::string buffer;
+        long long position = offsets[begin];
+        for (long long i = begin; i < end; i++) {
+            format(i, buffer);
+            if (buffer.size() >= flushSize || i + 1 == end) {
+                if (!writeFully(fd, buffer.data(), buffer.size(), position)) {
+                    failed = true;
+                }
+                position += buffer.size();
+                buffer.clear();
+            }
+        }
+        if (position != offsets[end]) {
+            failed = true;
+        }
+    });
+    if (failed) {
+        std::cerr << "Error: unable to write output to " << filename << std::endl;
+    }
+    close(fd);
+}
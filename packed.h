@@ -0,0 +1,290 @@
+// packed.h
+
+#include <algorithm>
+#include <array>
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <utility>
+#include <vector>
+
+
+// the 2-bit code of each base, with U and T sharing a code, and -1 for any
+// other character, as a table, so that coding a base does not branch on it
+constexpr std::array<int8_t, 256> makePackedBaseCodes() {
+    std::array<int8_t, 256> codes = {};
+    for (int c = 0; c < 256; c++) {
+        codes[c] = -1;
+    }
+    codes['A'] = 0;
+    codes['C'] = 1;
+    codes['G'] = 2;
+    codes['U'] = 3;
+    codes['T'] = 3;
+    return codes;
+}
+
+constexpr std::array<int8_t, 256> PACKED_BASE_CODES = makePackedBaseCodes();
+
+int8_t packedBaseCode(char base) {
+    return PACKED_BASE_CODES[(unsigned char) base];
+}
+
+
+// the code of the Watson-Crick complement of a base, given its code
+int8_t packedComplementCode(int8_t code) {
+    return 3 - code;
+}
+
+
+// a well mixed 64-bit hash of a packed sequence (the splitmix64 finaliser)
+uint64_t packedHash(uint64_t packed) {
+    packed ^= packed >> 30;
+    packed *= 0xbf58476d1ce4e5b9ULL;
+    packed ^= packed >> 27;
+    packed *= 0x94d049bb133111ebULL;
+    packed ^= packed >> 31;
+    return packed;
+}
+
+
+// a 64-bit key of the bases of sequence from start, packed two bits per base
+// and hashed down to 64 bits every 32 bases, so that substrings of any length
+// can key a hash table
+uint64_t packedSubstringKey(const std::string& sequence, int start, int length) {
+    uint64_t key = 0;
+    for (int i = 0; i < length; i++) {
+        if (i > 0 && i % 32 == 0) {
+            key = packedHash(key);
+        }
+        key = (key << 2) | (packedBaseCode(sequence[start + i]) & 3);
+    }
+    return key;
+}
+
+
+// the four bases of each byte of four 2-bit base codes, lowest bits first,
+// with code 3 as U or as T, so that a packed sequence decodes a byte at a time
+constexpr std::array<std::array<char, 4>, 256> makePackedQuads(char three) {
+    const char bases[4] = {'A', 'C', 'G', three};
+    std::array<std::array<char, 4>, 256> quads = {};
+    for (int byte = 0; byte < 256; byte++) {
+        for (int i = 0; i < 4; i++) {
+            quads[byte][i] = bases[(byte >> (2 * i)) & 3];
+        }
+    }
+    return quads;
+}
+
+constexpr std::array<std::array<char, 4>, 256> PACKED_RNA_QUADS = makePackedQuads('U');
+constexpr std::array<std::array<char, 4>, 256> PACKED_DNA_QUADS = makePackedQuads('T');
+
+
+// the complement of each IUPAC code, and any other character as it is
+constexpr std::array<char, 256> makePackedComplements() {
+    std::array<char, 256> complements = {};
+    for (int c = 0; c < 256; c++) {
+        complements[c] = c;
+    }
+    const char pairs[][2] = {{'A', 'U'}, {'C', 'G'}, {'R', 'Y'}, {'K', 'M'}, {'B', 'V'}, {'D', 'H'}};
+    for (auto& pair : pairs) {
+        complements[(unsigned char) pair[0]] = pair[1];
+        complements[(unsigned char) pair[1]] = pair[0];
+    }
+    complements['T'] = 'A';
+    return complements;
+}
+
+constexpr std::array<char, 256> PACKED_COMPLEMENTS = makePackedComplements();
+
+
+// a sequence stored at two bits per base, 32 bases to a word, with the few
+// bases that have no 2-bit code, such as N and the other IUPAC codes, kept as
+// exceptions, whose codes are left as zero. The words and then the exceptions,
+// one word each holding the position above the character, share one buffer,
+// so a sequence is a single allocation. Code 3 stands for T in a sequence
+// with more T than U, and for U otherwise, and the other letter is kept as
+// exceptions. Equal sequences have equal buffers, so they are compared and
+// hashed without being decoded.
+class PackedSequence {
+    public:
+        PackedSequence() {}
+
+        PackedSequence(const std::string& sequence) {
+            this->length = sequence.size();
+            long long numT = 0, numU = 0;
+            for (char base : sequence) {
+                numT += base == 'T';
+                numU += base == 'U';
+            }
+            this->thymine = numT > numU;
+            char three = this->thymine ? 'T' : 'U';
+            this->data.resize(this->numWords());
+            std::vector<uint64_t> exceptions;
+            for (int w = 0; w < this->numWords(); w++) {
+                uint64_t word = 0;
+                for (int i = 32 * w; i < std::min(this->length, 32 * w + 32); i++) {
+                    int8_t code = packedBaseCode(sequence[i]);
+                    if ((code < 0) | ((code == 3) & (sequence[i] != three))) {
+                        exceptions.push_back(((uint64_t) i << 8) | (unsigned char) sequence[i]);
+                        code = 0;
+                    }
+                    word |= (uint64_t) code << (2 * (i - 32 * w));
+                }
+                this->data[w] = word;
+            }
+            this->data.insert(this->data.end(), exceptions.begin(), exceptions.end());
+        }
+
+        int size() const {
+            return this->length;
+        }
+
+        bool empty() const {
+            return this->length == 0;
+        }
+
+        // append the bases to out, four at a time from a table, and then
+        // write the exceptions over them
+        void appendTo(std::string& out) const {
+            size_t start = out.size();
+            out.resize(start + this->length);
+            char* bases = &out[start];
+            const std::array<std::array<char, 4>, 256>& quads = this->thymine ? PACKED_DNA_QUADS : PACKED_RNA_QUADS;
+            int i = 0;
+            for (; i + 4 <= this->length; i += 4) {
+                std::memcpy(bases + i, quads[(this->data[i / 32] >> (2 * (i % 32))) & 255].data(), 4);
+            }
+            for (; i < this->length; i++) {
+                bases[i] = quads[(this->data[i / 32] >> (2 * (i % 32))) & 3][0];
+            }
+            for (int k = this->numWords(); k < this->data.size(); k++) {
+                bases[this->data[k] >> 8] = this->data[k] & 255;
+            }
+        }
+
+        std::string toString() const {
+            std::string sequence;
+            this->appendTo(sequence);
+            return sequence;
+        }
+
+        bool operator==(const PackedSequence& other) const {
+            if (this->length != other.length || this->data != other.data) {
+                return false;
+            }
+            return this->thymine == other.thymine || !this->hasCodeThree();
+        }
+
+        bool operator!=(const PackedSequence& other) const {
+            return !(*this == other);
+        }
+
+        // a hash of the sequence, which does not depend on whether code 3
+        // stands for T or U, so that equal sequences hash alike
+        uint64_t hash() const {
+            uint64_t hash = packedHash(this->length + 1);
+            for (uint64_t word : this->data) {
+                hash = packedHash(hash ^ word);
+            }
+            return hash;
+        }
+
+        // the reverse complement, built a word at a time: the 2-bit codes of
+        // each word are reversed and inverted, since the complement of code c
+        // is 3 - c, and the words are then shifted back into place
+        PackedSequence reverseComplement() const {
+            PackedSequence reverse;
+            reverse.length = this->length;
+            reverse.thymine = this->thymine;
+            int numWords = this->numWords();
+            int shift = 2 * (32 * numWords - this->length);
+            std::vector<uint64_t> reversed(numWords + 1, 0);
+            for (int j = 0; j < numWords; j++) {
+                uint64_t word = this->data[numWords - 1 - j];
+                word = ((word >> 2) & 0x3333333333333333ULL) | ((word & 0x3333333333333333ULL) << 2);
+                word = ((word >> 4) & 0x0f0f0f0f0f0f0f0fULL) | ((word & 0x0f0f0f0f0f0f0f0fULL) << 4);
+                reversed[j] = ~__builtin_bswap64(word);
+            }
+            reverse.data.resize(numWords);
+            for (int j = 0; j < numWords; j++) {
+                reverse.data[j] = shift == 0 ? reversed[j] : (reversed[j] >> shift) | (reversed[j + 1] << (64 - shift));
+            }
+            if (this->length % 32 != 0) {
+                reverse.data.back() &= (1ULL << (2 * (this->length % 32))) - 1;
+            }
+
+            // the exceptions are complemented in place, and their codes cleared
+            char three = this->thymine ? 'T' : 'U';
+            for (int k = this->data.size() - 1; k >= numWords; k--) {
+                int position = this->length - 1 - (this->data[k] >> 8);
+                char base = PACKED_COMPLEMENTS[this->data[k] & 255];
+                reverse.data[position / 32] &= ~(3ULL << (2 * (position % 32)));
+                int8_t code = packedBaseCode(base);
+                if (code >= 0 && (code != 3 || base == three)) {
+                    reverse.data[position / 32] |= (uint64_t) code << (2 * (position % 32));
+                } else {
+                    reverse.data.push_back(((uint64_t) position << 8) | (unsigned char) base);
+                }
+            }
+            return reverse;
+        }
+
+        // make code 3 stand for U, or for T, converting any exceptions too
+        void toRNA() {
+            this->setThymine(false);
+        }
+
+        void toDNA() {
+            this->setThymine(true);
+        }
+
+        // the number of bytes the sequence takes, including its buffer
+        long long memoryUsage() const {
+            return sizeof(PackedSequence) + this->data.capacity() * sizeof(uint64_t);
+        }
+
+    private:
+        int length = 0;
+        bool thymine = false;
+        std::vector<uint64_t> data;
+
+        int numWords() const {
+            return (this->length + 31) / 32;
+        }
+
+        bool hasCodeThree() const {
+            for (int j = 0; j < this->numWords(); j++) {
+                if (this->data[j] & (this->data[j] >> 1) & 0x5555555555555555ULL) {
+                    return true;
+                }
+            }
+            return false;
+        }
+
+        void setThymine(bool thymine) {
+            bool mixed = false;
+            for (int k = this->numWords(); k < this->data.size(); k++) {
+                char base = this->data[k] & 255;
+                mixed |= base == 'T' || base == 'U';
+            }
+            if (mixed) {
+                std::string sequence = this->toString();
+                for (char& base : sequence) {
+                    if (base == 'T' || base == 'U') {
+                        base = thymine ? 'T' : 'U';
+                    }
+                }
+                *this = PackedSequence(sequence);
+            }
+            this->thymine = thymine;
+        }
+};
+
+
+// a hash functor for containers of packed sequences
+struct PackedSequenceHash {
+    size_t operator()(const PackedSequence& sequence) const {
+        return sequence.hash();
+    }
+};
@@ -0,0 +1,138 @@
+// padding.h
+
+#include <string>
+#include <vector>
+#include <random>
+#include <unordered_map>
+
+
+// generates padding for many sequences at once. Sequences are grouped by the
+// amount of padding they require, so that the decomposition of each distinct
+// length into stems is computed once, and the stems themselves are generated
+// in bulk, in parallel, into one pool per stem length. Every stem in a pool is
+// drawn exactly once, so the padding of each sequence remains independently
+// random.
+class PaddingEngine {
+    public:
+        int minStemLength;
+        int maxStemLength;
+        std::vector<int> maxOccurences;
+        std::string stemLoop;
+        SequenceConstraints constraints;
+
+        // the k-mers that the padding must avoid, if any
+        const KmerIndex* screen = nullptr;
+
+        PaddingEngine(
+            int minStemLength,
+            int maxStemLength,
+            std::vector<int> maxOccurences,
+            std::string stemLoop,
+            const SequenceConstraints& constraints = NO_CONSTRAINTS
+        ) {
+            this->minStemLength = minStemLength;
+            this->maxStemLength = maxStemLength;
+            this->maxOccurences = maxOccurences;
+            this->stemLoop = stemLoop;
+            this->constraints = constraints;
+        }
+
+
+        // generate the padding for each of the given padding lengths
+        std::vector<std::string> generate(const std::vector<int>& paddingLengths) {
+
+            // compute the plan of each distinct padding length once
+            std::unordered_map<int, std::vector<int> > plans;
+            for (int paddingLength : paddingLengths) {
+                if (plans.find(paddingLength) == plans.end()) {
+                    plans[paddingLength] = getPaddingPlan(paddingLength, this->minStemLength, this->maxStemLength, this->stemLoop.size());
+                }
+            }
+
+            // assign every stem that is required a slot in the pool of its
+            // length, in the order of the sequences
+            std::unordered_map<int, long long> poolSizes;
+            std::vector<long long> firstSlot(paddingLengths.size());
+            std::vector<std::pair<int, long long> > slots;
+            for (int i = 0; i < paddingLengths.size(); i++) {
+                firstSlot[i] = slots.size();
+                for (int segment : plans[paddingLengths[i]]) {
+                    if (segment >= 0) {
+                        slots.push_back({segment, poolSizes[segment]++});
+                    }
+                }
+            }
+
+            // fill the pools in parallel. The maps are only read with at() from
+            // the worker threads, which is safe to do concurrently. Without
+            // constraints, each thread writes its whole share of a pool of stems
+            // into one buffer, which is then cut into the stems.
+            std::unordered_map<int, std::vector<std::string> > pools;
+            for (auto& poolSize : poolSizes) {
+                pools[poolSize.first] = std::vector<std::string>(poolSize.second);
+            }
+            if (this->constraints.isEnabled()) {
+                parallelFor(slots.size(), [&](long long begin, long long end, int thread) {
+                    std::random_device rd;
+                    std::mt19937 gen(rd());
+                    for (long long i = begin; i < end; i++) {
+                        pools.at(slots[i].first)[slots[i].second] = Barcode(slots[i].first, this->maxOccurences, this->stemLoop, gen, this->constraints).toString();
+                    }
+                });
+            } else {
+                for (auto& pool : pools) {
+                    int length = pool.first;
+                    long long width = 2 * length + this->stemLoop.size();
+                    std::vector<std::string>& stems = pool.second;
+                    parallelFor(stems.size(), [&](long long begin, long long end, int thread) {
+                        std::random_device rd;
+                        std::mt19937 gen(rd());
+                        std::string buffer((end - begin) * width, ' ');
+                        fillRandomStemBarcodes(&buffer[0], end - begin, length, this->maxOccurences, this->stemLoop, gen);
+                        for (long long i = begin; i < end; i++) {
+                            stems[i].assign(buffer, (i - begin) * width, width);
+                        }
+                    });
+                }
+            }
+
+            // assemble the padding of each sequence from its stems, adding any
+            // random bases that the plan requires
+            std::vector<std::string> paddings(paddingLengths.size());
+            parallelFor(paddingLengths.size(), [&](long long begin, long long end, int thread) {
+                std::random_device rd;
+                std::mt19937 gen(rd());
+                for (long long i = begin; i < end; i++) {
+                    long long slot = firstSlot[i];
+                    for (int segment : plans.at(paddingLengths[i])) {
+                        if (segment < 0) {
+                            paddings[i] += generateRandomSequence(-segment, gen, this->constraints);
+                        } else {
+                            paddings[i] += pools.at(segment)[slots[slot++].second];
+                        }
+                    }
+
+                    // the pooled segments each satisfy the constraints, but the
+                    // junctions between them may not, in which case the padding
+                    // is generated again segment by segment
+                    if (this->constraints.isEnabled() && !this->constraints.isSatisfiedBy(paddings[i])) {
+                        paddings[i] = getPadding(paddingLengths[i], this->minStemLength, this->maxStemLength, this->maxOccurences, this->stemLoop, gen, this->constraints);
+                    }
+
+                    // padding that shares a k-mer with a design or constant
+                    // region is generated again until it does not
+                    int attempts = 0;
+                    while (this->screen != nullptr && this->screen->isEnabled() && this->screen->containsAnyKmerOf(paddings[i])) {
+                        METRICS.kmerScreenRejections.fetch_add(1, std::memory_order_relaxed);
+                        if (++attempts > CONSTRAINT_MAX_ATTEMPTS) {
+                            std::cout << "Error: unable to generate padding of length " << paddingLengths[i] << " that avoids the k-mers of the design regions." << std::endl;
+                            exit(EXIT_FAILURE);
+                        }
+                        paddings[i] = getPadding(paddingLengths[i], this->minStemLength, this->maxStemLength, this->maxOccurences, this->stemLoop, gen, this->constraints);
+                    }
+                }
+            });
+
+            return paddings;
+        }
+};
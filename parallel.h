@@ -0,0 +1,235 @@
+// parallel.h
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+
+// the number of threads used by parallel passes, which is set from --threads
+int NUM_THREADS = std::max(1u, std::thread::hardware_concurrency());
+
+// the number of chunks each thread's share of a pass is split into, so that
+// threads that finish early can steal work from those that do not
+const int CHUNKS_PER_THREAD = 8;
+
+
+// a process-wide pool of NUM_THREADS - 1 worker threads, which run the chunks
+// of one pass at a time together with the thread that submits it. Each
+// participant is dealt a contiguous block of chunks, which it runs from the
+// front, and once its block is empty it steals chunks from the back of the
+// others', so that neighbouring chunks mostly run on the same thread. A block
+// is a front and a back index packed into one atomic word, so that taking and
+// stealing a chunk are each a single compare-and-swap.
+class WorkStealingPool {
+    public:
+        static WorkStealingPool& instance() {
+            static WorkStealingPool pool;
+            return pool;
+        }
+
+        ~WorkStealingPool() {
+            this->stopWorkers();
+        }
+
+        // run runChunk(chunk, thread) on every chunk in [0, numChunks), where
+        // thread is in [0, NUM_THREADS) and no two chunks that run at the same
+        // time share it. A pass submitted from within a pass runs serially.
+        void run(long long numChunks, const std::function<void(long long, int)>& runChunk) {
+            if (CURRENT_THREAD >= 0 || NUM_THREADS <= 1 || numChunks <= 1) {
+                for (long long chunk = 0; chunk < numChunks; chunk++) {
+                    runChunk(chunk, std::max(0, CURRENT_THREAD));
+                }
+                return;
+            }
+
+            std::lock_guard<std::mutex> submitLock(this->submitMutex);
+            if (this->workers.size() != NUM_THREADS - 1) {
+                this->stopWorkers();
+                this->startWorkers(NUM_THREADS);
+            }
+
+            int numParticipants = std::min<long long>(NUM_THREADS, numChunks);
+            for (int thread = 0; thread < this->blocks.size(); thread++) {
+                uint64_t front = thread < numParticipants ? thread * numChunks / numParticipants : 0;
+                uint64_t back = thread < numParticipants ? (thread + 1) * numChunks / numParticipants : 0;
+                this->blocks[thread].store((front << 32) | back);
+            }
+            {
+                std::unique_lock<std::mutex> lock(this->mutex);
+                this->runChunk = &runChunk;
+                this->numParticipants = numParticipants;
+                this->numActive = numParticipants - 1;
+                this->generation++;
+            }
+            this->wake.notify_all();
+
+            CURRENT_THREAD = 0;
+            this->work(0);
+            CURRENT_THREAD = -1;
+
+            std::unique_lock<std::mutex> lock(this->mutex);
+            this->done.wait(lock, [&]() {
+                return this->numActive == 0;
+            });
+            this->runChunk = nullptr;
+        }
+
+    private:
+        // the participant that the calling thread is in the current pass, or
+        // -1 if it is not running a chunk
+        static thread_local int CURRENT_THREAD;
+
+        std::vector<std::thread> workers;
+        std::vector<std::atomic<uint64_t> > blocks;
+        std::mutex submitMutex;
+        std::mutex mutex;
+        std::condition_variable wake;
+        std::condition_variable done;
+        const std::function<void(long long, int)>* runChunk = nullptr;
+        int numParticipants = 0;
+        int numActive = 0;
+        long long generation = 0;
+        bool stopping = false;
+
+        // start the workers as having seen the current generation, so that
+        // workers started again after NUM_THREADS changes do not rerun the
+        // last pass
+        void startWorkers(int numThreads) {
+            this->blocks = std::vector<std::atomic<uint64_t> >(numThreads);
+            long long seen;
+            {
+                std::unique_lock<std::mutex> lock(this->mutex);
+                this->stopping = false;
+                seen = this->generation;
+            }
+            for (int thread = 1; thread < numThreads; thread++) {
+                this->workers.push_back(std::thread(&WorkStealingPool::workerLoop, this, thread, seen));
+            }
+        }
+
+        void stopWorkers() {
+            {
+                std::unique_lock<std::mutex> lock(this->mutex);
+                this->stopping = true;
+            }
+            this->wake.notify_all();
+            for (std::thread& worker : this->workers) {
+                worker.join();
+            }
+            this->workers.clear();
+        }
+
+        void workerLoop(int thread, long long seen) {
+            while (true) {
+                {
+                    std::unique_lock<std::mutex> lock(this->mutex);
+                    this->wake.wait(lock, [&]() {
+                        return this->stopping || this->generation != seen;
+                    });
+                    if (this->stopping) {
+                        return;
+                    }
+                    seen = this->generation;
+                    if (thread >= this->numParticipants) {
+                        continue;
+                    }
+                }
+
+                CURRENT_THREAD = thread;
+                this->work(thread);
+                CURRENT_THREAD = -1;
+
+                {
+                    std::unique_lock<std::mutex> lock(this->mutex);
+                    this->numActive--;
+                }
+                this->done.notify_all();
+            }
+        }
+
+        // run chunks from the front of the thread's own block, and then from
+        // the back of the others', until there are none left
+        void work(int thread) {
+            long long chunk;
+            while (this->take(thread, chunk) || this->steal(thread, chunk)) {
+                (*this->runChunk)(chunk, thread);
+            }
+        }
+
+        bool take(int thread, long long& chunk) {
+            uint64_t block = this->blocks[thread].load();
+            while ((block >> 32) < (block & 0xffffffff)) {
+                if (this->blocks[thread].compare_exchange_weak(block, block + (1ULL << 32))) {
+                    chunk = block >> 32;
+                    return true;
+                }
+            }
+            return false;
+        }
+
+        bool steal(int thread, long long& chunk) {
+            for (int offset = 1; offset < this->numParticipants; offset++) {
+                int victim = (thread + offset) % this->numParticipants;
+                uint64_t block = this->blocks[victim].load();
+                while ((block >> 32) < (block & 0xffffffff)) {
+                    if (this->blocks[victim].compare_exchange_weak(block, block - 1)) {
+                        chunk = (block & 0xffffffff) - 1;
+                        return true;
+                    }
+                }
+            }
+            return false;
+        }
+};
+
+thread_local int WorkStealingPool::CURRENT_THREAD = -1;
+
+
+// the size of the chunks that a pass over n items is split into
+long long parallelChunkSize(long long n) {
+    return std::max(1LL, (n + (long long) NUM_THREADS * CHUNKS_PER_THREAD - 1) / ((long long) NUM_THREADS * CHUNKS_PER_THREAD));
+}
+
+
+// split the range [0, n) into chunks, and call fn(begin, end, thread) on each
+// chunk on the pool, where thread identifies the thread running it, so that
+// it may index per-thread state
+void parallelFor(long long n, std::function<void(long long, long long, int)> fn) {
+    if (NUM_THREADS <= 1) {
+        if (n > 0) {
+            fn(0, n, 0);
+        }
+        return;
+    }
+
+    long long chunkSize = parallelChunkSize(n);
+    long long numChunks = (n + chunkSize - 1) / chunkSize;
+    WorkStealingPool::instance().run(numChunks, [&](long long chunk, int thread) {
+        fn(chunk * chunkSize, std::min(n, (chunk + 1) * chunkSize), thread);
+    });
+}
+
+
+// reduce the range [0, n) in parallel: map(begin, end) gives the result of
+// each chunk, and the results are combined in the order of the chunks, so that
+// the result does not depend on which thread ran which chunk
+template <typename T, typename Map, typename Combine>
+T parallelReduce(long long n, T identity, Map map, Combine combine) {
+    long long chunkSize = parallelChunkSize(n);
+    long long numChunks = (n + chunkSize - 1) / chunkSize;
+    std::vector<T> results(numChunks, identity);
+    WorkStealingPool::instance().run(numChunks, [&](long long chunk, int thread) {
+        results[chunk] = map(chunk * chunkSize, std::min(n, (chunk + 1) * chunkSize));
+    });
+
+    T result = identity;
+    for (T& chunkResult : results) {
+        result = combine(result, chunkResult);
+    }
+    return result;
+}
@@ -0,0 +1,409 @@
+// registry.h
+
+#include <cerrno>
+#include <cstdint>
+#include <cstring>
+#include <fcntl.h>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <thread>
+#include <unistd.h>
+#include <unordered_set>
+#include <vector>
+
+
+// the longest barcode stem, in base pairs, that a registry key can hold
+const int REGISTRY_MAX_STEM_LENGTH = 21;
+
+// the number of barcodes a client reserves in one round trip
+const int REGISTRY_BATCH_SIZE = 4096;
+
+// the number of round trips in a row in which the registry rejects every
+// candidate before a client gives up, the registry being taken as full
+const int REGISTRY_MAX_FAILED_ROUNDS = 64;
+
+// the largest number of barcodes the server accepts in one request
+const uint32_t REGISTRY_MAX_REQUEST = 1 << 22;
+
+// the operations of the registry protocol. Reserve adds each barcode unless it
+// or a barcode one base pair away is registered, check only reports whether it
+// could, claim adds each barcode as it is, reporting whether it was new, and
+// release removes each barcode, reporting whether it was registered.
+const uint8_t REGISTRY_RESERVE = 'R';
+const uint8_t REGISTRY_CHECK = 'C';
+const uint8_t REGISTRY_CLAIM = 'F';
+const uint8_t REGISTRY_RELEASE = 'D';
+const uint8_t REGISTRY_COUNT = 'N';
+
+
+// the registry key of a stem barcode: the index of each base pair in
+// RNA_PAIRS, three bits each with the innermost lowest, under a leading set
+// bit that marks the length. Returns 0 if the barcode is not a stem of matching pairs
+// around a loop of loopLength bases, or is too long.
+uint64_t registryKey(const std::string& barcode, int loopLength) {
+    int length = ((int) barcode.size() - loopLength) / 2;
+    if (length <= 0 || length > REGISTRY_MAX_STEM_LENGTH || 2 * length + loopLength != barcode.size()) {
+        return 0;
+    }
+    uint64_t key = 1;
+    for (int i = length - 1; i >= 0; i--) {
+        char five = barcode[length - 1 - i] == 'T' ? 'U' : barcode[length - 1 - i];
+        char three = barcode[length + loopLength + i] == 'T' ? 'U' : barcode[length + loopLength + i];
+        int pair = 0;
+        while (pair < 6 && (PAIR_FIVE_PRIME_BASES[pair] != five || PAIR_THREE_PRIME_BASES[pair] != three)) {
+            pair++;
+        }
+        if (pair == 6) {
+            return 0;
+        }
+        key = (key << 3) | pair;
+    }
+    return key;
+}
+
+
+// the set of barcodes shared by every library designed against the registry,
+// as keys, with a write-ahead log of every key added or removed so that the
+// set survives a restart. The log is a header followed by the keys added, with
+// each key removed written after a 0, which is never a key, and is synced
+// before any request that changed the set is answered.
+class BarcodeRegistry {
+    public:
+        BarcodeRegistry(std::string logFilename) {
+            this->logFilename = logFilename;
+            this->replay();
+            this->logFile = open(logFilename.c_str(), O_WRONLY | O_APPEND | O_CREAT, 0644);
+            if (this->logFile < 0) {
+                std::cerr << "Unable to open the registry log: " << logFilename << std::endl;
+                exit(EXIT_FAILURE);
+            }
+            if (lseek(this->logFile, 0, SEEK_END) == 0) {
+                this->writeToLog(BarcodeRegistry::MAGIC, 8);
+            }
+        }
+
+        ~BarcodeRegistry() {
+            if (this->logFile >= 0) {
+                close(this->logFile);
+            }
+        }
+
+        long long size() const {
+            return this->keys.size();
+        }
+
+        // whether neither the barcode nor any barcode one base pair away from
+        // it, as in Barcode::hammingOneBall, is registered
+        bool isAvailable(uint64_t key) const {
+            if (key == 0 || this->keys.count(key)) {
+                return false;
+            }
+            for (int shift = 0; (key >> shift) > 1; shift += 3) {
+                int pair = (key >> shift) & 7;
+                for (int neighbour : STEM_NEIGHBOURS[pair]) {
+                    if (neighbour >= 0 && this->keys.count(key ^ ((uint64_t) (pair ^ neighbour) << shift))) {
+                        return false;
+                    }
+                }
+            }
+            return true;
+        }
+
+        // run a request, writing a status byte for each key to statuses
+        void handle(uint8_t operation, const std::vector<uint64_t>& keys, std::vector<uint8_t>& statuses) {
+            std::lock_guard<std::mutex> lock(this->mutex);
+            std::vector<uint64_t> logged;
+            statuses.assign(keys.size(), 0);
+            for (long long i = 0; i < keys.size(); i++) {
+                if (operation == REGISTRY_CHECK) {
+                    statuses[i] = this->isAvailable(keys[i]);
+                } else if (operation == REGISTRY_RESERVE && this->isAvailable(keys[i])) {
+                    statuses[i] = 1;
+                } else if (operation == REGISTRY_CLAIM && keys[i] != 0 && !this->keys.count(keys[i])) {
+                    statuses[i] = 1;
+                } else if (operation == REGISTRY_RELEASE && this->keys.count(keys[i])) {
+                    statuses[i] = 1;
+                }
+                if (statuses[i] && operation == REGISTRY_RELEASE) {
+                    this->keys.erase(keys[i]);
+                    logged.push_back(0);
+                    logged.push_back(keys[i]);
+                } else if (statuses[i] && operation != REGISTRY_CHECK) {
+                    this->keys.insert(keys[i]);
+                    logged.push_back(keys[i]);
+                }
+            }
+            if (!logged.empty()) {
+                this->writeToLog(logged.data(), logged.size() * sizeof(uint64_t));
+                fdatasync(this->logFile);
+            }
+        }
+
+        long long count() {
+            std::lock_guard<std::mutex> lock(this->mutex);
+            return this->keys.size();
+        }
+
+    private:
+        static constexpr const char* MAGIC = "FLDREG1\n";
+        std::string logFilename;
+        int logFile = -1;
+        std::unordered_set<uint64_t> keys;
+        std::mutex mutex;
+
+        // read the keys of the log, dropping any partly written key or removal
+        // at its end
+        void replay() {
+            int file = open(this->logFilename.c_str(), O_RDWR);
+            if (file < 0) {
+                return;
+            }
+            struct stat status;
+            fstat(file, &status);
+            char magic[8];
+            if (status.st_size >= 8 && (pread(file, magic, 8, 0) != 8 || std::string(magic, 8) != BarcodeRegistry::MAGIC)) {
+                std::cerr << "Error: " << this->logFilename << " is not a barcode registry log." << std::endl;
+                exit(EXIT_FAILURE);
+            }
+            long long numKeys = std::max<long long>(0, status.st_size - 8) / sizeof(uint64_t);
+            std::vector<uint64_t> logged(numKeys);
+            char* bytes = (char*) logged.data();
+            for (long long offset = 0; offset < numKeys * sizeof(uint64_t); ) {
+                ssize_t count = pread(file, bytes + offset, numKeys * sizeof(uint64_t) - offset, 8 + offset);
+                if (count <= 0) {
+                    std::cerr << "Unable to read the registry log: " << this->logFilename << std::endl;
+                    exit(EXIT_FAILURE);
+                }
+                offset += count;
+            }
+            for (long long i = 0; i < numKeys; i++) {
+                if (logged[i] != 0) {
+                    this->keys.insert(logged[i]);
+                } else if (i + 1 < numKeys) {
+                    this->keys.erase(logged[++i]);
+                } else {
+                    numKeys--;
+                }
+            }
+            if (ftruncate(file, status.st_size < 8 ? 0 : 8 + numKeys * sizeof(uint64_t)) != 0) {
+                std::cerr << "Unable to truncate the registry log: " << this->logFilename << std::endl;
+            }
+            close(file);
+        }
+
+        void writeToLog(const void* data, size_t size) {
+            const char* bytes = (const char*) data;
+            while (size > 0) {
+                ssize_t written = write(this->logFile, bytes, size);
+                if (written < 0 && errno == EINTR) {
+                    continue;
+                }
+                if (written <= 0) {
+                    std::cerr << "Unable to write the registry log: " << this->logFilename << std::endl;
+                    exit(EXIT_FAILURE);
+                }
+                bytes += written;
+                size -= written;
+            }
+        }
+};
+
+
+// read or write exactly size bytes of a socket, returning false if the other
+// end has closed it
+bool registryReceive(int socket, void* data, size_t size) {
+    char* bytes = (char*) data;
+    while (size > 0) {
+        ssize_t received = recv(socket, bytes, size, 0);
+        if (received < 0 && errno == EINTR) {
+            continue;
+        }
+        if (received <= 0) {
+            return false;
+        }
+        bytes += received;
+        size -= received;
+    }
+    return true;
+}
+
+bool registrySend(int socket, const void* data, size_t size) {
+    const char* bytes = (const char*) data;
+    while (size > 0) {
+        ssize_t sent = send(socket, bytes, size, MSG_NOSIGNAL);
+        if (sent < 0 && errno == EINTR) {
+            continue;
+        }
+        if (sent <= 0) {
+            return false;
+        }
+        bytes += sent;
+        size -= sent;
+    }
+    return true;
+}
+
+
+// the address of a Unix domain socket at a path
+bool registryAddress(const std::string& socketPath, sockaddr_un& address) {
+    std::memset(&address, 0, sizeof(address));
+    address.sun_family = AF_UNIX;
+    if (socketPath.size() >= sizeof(address.sun_path)) {
+        std::cerr << "Error: the socket path " << socketPath << " is too long." << std::endl;
+        return false;
+    }
+    std::strcpy(address.sun_path, socketPath.c_str());
+    return true;
+}
+
+
+// serve the registry on a Unix domain socket until the process is stopped,
+// with a thread for each connected client. A request is an operation byte,
+// three bytes of padding and a 32-bit count, followed by that many 64-bit
+// keys, and is answered with a status byte for each key, or, for a count
+// request, with the 64-bit number of registered barcodes. Each request is
+// handled as a whole before any other, so a batch sees the barcodes reserved
+// by every batch before it.
+void serveBarcodeRegistry(std::string socketPath, BarcodeRegistry& registry) {
+    sockaddr_un address;
+    int server = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (server < 0 || !registryAddress(socketPath, address)) {
+        std::cerr << "Unable to create the registry socket: " << socketPath << std::endl;
+        exit(EXIT_FAILURE);
+    }
+    unlink(socketPath.c_str());
+    if (bind(server, (sockaddr*) &address, sizeof(address)) != 0 || listen(server, 64) != 0) {
+        std::cerr << "Unable to listen on " << socketPath << ": " << std::strerror(errno) << std::endl;
+        exit(EXIT_FAILURE);
+    }
+    std::cout << "Serving " << registry.size() << " registered barcodes on " << socketPath << "." << std::endl;
+
+    while (true) {
+        int client = accept(server, nullptr, nullptr);
+        if (client < 0) {
+            if (errno != EINTR) {
+                std::cerr << "Unable to accept a registry client: " << std::strerror(errno) << std::endl;
+            }
+            continue;
+        }
+        std::thread([client, &registry]() {
+            uint8_t header[8];
+            std::vector<uint64_t> keys;
+            std::vector<uint8_t> statuses;
+            while (registryReceive(client, header, sizeof(header))) {
+                uint32_t count;
+                std::memcpy(&count, header + 4, sizeof(count));
+                if (count > REGISTRY_MAX_REQUEST) {
+                    break;
+                }
+                keys.resize(count);
+                if (!registryReceive(client, keys.data(), count * sizeof(uint64_t))) {
+                    break;
+                }
+                if (header[0] == REGISTRY_COUNT) {
+                    uint64_t size = registry.count();
+                    if (!registrySend(client, &size, sizeof(size))) {
+                        break;
+                    }
+                    continue;
+                }
+                registry.handle(header[0], keys, statuses);
+                if (!registrySend(client, statuses.data(), statuses.size())) {
+                    break;
+                }
+            }
+            close(client);
+        }).detach();
+    }
+}
+
+
+// a connection to a barcode registry, through which a library claims its
+// barcodes so that it stays apart from every other library designed against
+// the same registry. A default-constructed client is not connected.
+class BarcodeRegistryClient {
+    public:
+        BarcodeRegistryClient() {}
+
+        BarcodeRegistryClient(std::string socketPath, int loopLength) {
+            this->loopLength = loopLength;
+            sockaddr_un address;
+            int client = socket(AF_UNIX, SOCK_STREAM, 0);
+            if (client < 0 || !registryAddress(socketPath, address) || connect(client, (sockaddr*) &address, sizeof(address)) != 0) {
+                std::cerr << "Unable to connect to the barcode registry at " << socketPath << ": " << std::strerror(errno) << std::endl;
+                exit(EXIT_FAILURE);
+            }
+            this->connection = std::shared_ptr<int>(new int(client), [](int* client) {
+                close(*client);
+                delete client;
+            });
+        }
+
+        bool isEnabled() const {
+            return this->connection != nullptr;
+        }
+
+        // reserve each barcode, returning whether each was reserved
+        std::vector<uint8_t> reserve(const std::vector<std::string>& barcodes) {
+            return this->request(REGISTRY_RESERVE, barcodes);
+        }
+
+        // whether each barcode could be reserved, without reserving it
+        std::vector<uint8_t> check(const std::vector<std::string>& barcodes) {
+            return this->request(REGISTRY_CHECK, barcodes);
+        }
+
+        // register each barcode as it is, whatever its neighbours, returning
+        // whether each was not registered already
+        std::vector<uint8_t> claim(const std::vector<std::string>& barcodes) {
+            return this->request(REGISTRY_CLAIM, barcodes);
+        }
+
+        // remove each barcode, returning whether each was registered
+        std::vector<uint8_t> release(const std::vector<std::string>& barcodes) {
+            return this->request(REGISTRY_RELEASE, barcodes);
+        }
+
+        long long count() {
+            uint8_t header[8] = {REGISTRY_COUNT};
+            uint64_t size = 0;
+            if (!registrySend(*this->connection, header, sizeof(header)) || !registryReceive(*this->connection, &size, sizeof(size))) {
+                this->fail();
+            }
+            return size;
+        }
+
+    private:
+        std::shared_ptr<int> connection;
+        int loopLength = 0;
+
+        std::vector<uint8_t> request(uint8_t operation, const std::vector<std::string>& barcodes) {
+            std::vector<uint8_t> statuses;
+            for (long long begin = 0; begin < barcodes.size(); begin += REGISTRY_MAX_REQUEST) {
+                uint32_t count = std::min<long long>(REGISTRY_MAX_REQUEST, barcodes.size() - begin);
+                std::vector<uint8_t> message(8 + count * sizeof(uint64_t), 0);
+                message[0] = operation;
+                std::memcpy(&message[4], &count, sizeof(count));
+                for (uint32_t i = 0; i < count; i++) {
+                    uint64_t key = registryKey(barcodes[begin + i], this->loopLength);
+                    std::memcpy(&message[8 + i * sizeof(uint64_t)], &key, sizeof(key));
+                }
+                statuses.resize(begin + count);
+                METRICS.registryRequests.fetch_add(1, std::memory_order_relaxed);
+                if (!registrySend(*this->connection, message.data(), message.size()) || !registryReceive(*this->connection, &statuses[begin], count)) {
+                    this->fail();
+                }
+            }
+            return statuses;
+        }
+
+        void fail() {
+            std::cerr << "Error: lost the connection to the barcode registry." << std::endl;
+            exit(EXIT_FAILURE);
+        }
+};
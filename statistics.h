@@ -0,0 +1,295 @@
+// statistics.h
+
+#include <algorithm>
+#include <array>
+#include <cstdint>
+#include <fstream>
+#include <functional>
+#include <iostream>
+#include <map>
+#include <sstream>
+#include <string>
+#include <vector>
+
+
+// the index of each base in a composition count, which is its packed code,
+// and 4 for any other character
+int statisticsBaseIndex(char base) {
+    int8_t code = packedBaseCode(base);
+    return code < 0 ? 4 : code;
+}
+
+const char STATISTICS_BASE_NAMES[5] = {'A', 'C', 'G', 'U', 'N'};
+
+
+// statistics of a collection of sequences, each made up of one or more named
+// regions. Partial statistics of disjoint parts of a collection may be merged.
+class SequenceStatistics {
+    public:
+        std::vector<std::string> regionNames;
+        long long numSequences = 0;
+
+        // the number of sequences of each length, and of each length of each
+        // region
+        std::map<int, long long> lengths;
+        std::vector<std::map<int, long long> > regionLengths;
+
+        // the number of each base at each position of the sequences, in the
+        // order A, C, G, U or T, and any other character
+        std::vector<std::array<long long, 5> > composition;
+
+        // the number of each pair of bases in the barcode stems, indexed as
+        // the composition is, if the sequences have barcodes
+        std::array<std::array<long long, 5>, 5> barcodePairs = {};
+        long long numBarcodes = 0;
+
+        // the number of sequences, and of barcodes, that repeat an earlier one
+        long long duplicateSequences = 0;
+        long long duplicateBarcodes = 0;
+
+        SequenceStatistics(std::vector<std::string> regionNames = {}) {
+            this->regionNames = regionNames;
+            this->regionLengths.resize(regionNames.size());
+        }
+
+        // add the statistics of another part of the collection, other than the
+        // duplicate counts, which need every sequence at once
+        void merge(const SequenceStatistics& other) {
+            this->numSequences += other.numSequences;
+            for (auto& length : other.lengths) {
+                this->lengths[length.first] += length.second;
+            }
+            for (int region = 0; region < this->regionLengths.size(); region++) {
+                for (auto& length : other.regionLengths[region]) {
+                    this->regionLengths[region][length.first] += length.second;
+                }
+            }
+            if (this->composition.size() < other.composition.size()) {
+                this->composition.resize(other.composition.size(), {0, 0, 0, 0, 0});
+            }
+            for (int position = 0; position < other.composition.size(); position++) {
+                for (int base = 0; base < 5; base++) {
+                    this->composition[position][base] += other.composition[position][base];
+                }
+            }
+            for (int first = 0; first < 5; first++) {
+                for (int second = 0; second < 5; second++) {
+                    this->barcodePairs[first][second] += other.barcodePairs[first][second];
+                }
+            }
+            this->numBarcodes += other.numBarcodes;
+        }
+
+        // the fraction of G and C bases, over all positions or one position
+        double gcContent() const {
+            long long gc = 0;
+            long long total = 0;
+            for (int position = 0; position < this->composition.size(); position++) {
+                gc += this->composition[position][1] + this->composition[position][2];
+                total += this->baseCount(position);
+            }
+            return total > 0 ? (double) gc / total : 0;
+        }
+
+        double gcContentAt(int position) const {
+            long long total = this->baseCount(position);
+            return total > 0 ? (double) (this->composition[position][1] + this->composition[position][2]) / total : 0;
+        }
+
+        // the number of sequences whose length is not the given length
+        long long lengthDiscrepancy(int length) const {
+            auto found = this->lengths.find(length);
+            return this->numSequences - (found == this->lengths.end() ? 0 : found->second);
+        }
+
+        std::string toJSON() const {
+            std::ostringstream json;
+            json << "{\n";
+            json << "  \"sequences\": " << this->numSequences << ",\n";
+            json << "  \"duplicate_sequences\": " << this->duplicateSequences << ",\n";
+            json << "  \"lengths\": " << histogramToJSON(this->lengths) << ",\n";
+            json << "  \"region_lengths\": {";
+            for (int region = 0; region < this->regionNames.size(); region++) {
+                json << (region > 0 ? ", " : "") << "\"" << this->regionNames[region] << "\": " << histogramToJSON(this->regionLengths[region]);
+            }
+            json << "},\n";
+            json << "  \"gc_content\": " << this->gcContent() << ",\n";
+            json << "  \"composition\": [\n";
+            for (int position = 0; position < this->composition.size(); position++) {
+                json << "    {\"position\": " << position;
+                for (int base = 0; base < 5; base++) {
+                    json << ", \"" << STATISTICS_BASE_NAMES[base] << "\": " << this->composition[position][base];
+                }
+                json << ", \"gc\": " << this->gcContentAt(position) << "}";
+                json << (position + 1 < this->composition.size() ? ",\n" : "\n");
+            }
+            json << "  ],\n";
+            json << "  \"barcodes\": " << this->numBarcodes << ",\n";
+            json << "  \"duplicate_barcodes\": " << this->duplicateBarcodes << ",\n";
+            json << "  \"barcode_pairs\": {";
+            bool first = true;
+            for (int a = 0; a < 5; a++) {
+                for (int b = 0; b < 5; b++) {
+                    if (this->barcodePairs[a][b] > 0) {
+                        json << (first ? "" : ", ") << "\"" << STATISTICS_BASE_NAMES[a] << STATISTICS_BASE_NAMES[b] << "\": " << this->barcodePairs[a][b];
+                        first = false;
+                    }
+                }
+            }
+            json << "}\n";
+            json << "}\n";
+            return json.str();
+        }
+
+        // write the statistics as JSON to a file, or to stdout if the filename
+        // is "-"
+        void writeJSON(std::string filename) const {
+            if (filename == "-") {
+                std::cout << this->toJSON();
+                return;
+            }
+            std::ofstream file(filename);
+            if (!file.is_open()) {
+                std::cerr << "Unable to open file: " << filename << std::endl;
+                return;
+            }
+            file << this->toJSON();
+        }
+
+    private:
+        long long baseCount(int position) const {
+            long long total = 0;
+            for (int base = 0; base < 5; base++) {
+                total += this->composition[position][base];
+            }
+            return total;
+        }
+
+        static std::string histogramToJSON(const std::map<int, long long>& histogram) {
+            std::ostringstream json;
+            json << "{";
+            for (auto it = histogram.begin(); it != histogram.end(); it++) {
+                json << (it == histogram.begin() ? "" : ", ") << "\"" << it->first << "\": " << it->second;
+            }
+            json << "}";
+            return json.str();
+        }
+};
+
+
+// the number of items that repeat an earlier one, given a hash of every item
+// and a way to get the item itself, which is only needed when hashes collide
+long long countDuplicates(
+    std::vector<std::pair<uint64_t, long long> >& hashes,
+    std::function<std::string(long long)> itemOf
+    ) {
+    std::sort(hashes.begin(), hashes.end());
+    long long duplicates = 0;
+    for (long long begin = 0, end = 0; begin < hashes.size(); begin = end) {
+        while (end < hashes.size() && hashes[end].first == hashes[begin].first) {
+            end++;
+        }
+        if (end - begin == 1) {
+            continue;
+        }
+        std::vector<std::string> items;
+        for (long long i = begin; i < end; i++) {
+            items.push_back(itemOf(hashes[i].second));
+        }
+        std::sort(items.begin(), items.end());
+        duplicates += items.end() - std::unique(items.begin(), items.end());
+    }
+    return duplicates;
+}
+
+
+// compute the statistics of n sequences in a single parallel pass, where
+// regionsOf gives the regions of each sequence. If barcodeRegion is not -1,
+// that region is a hairpin barcode around a loop of barcodeLoopLength bases,
+// and the pairs of bases in its stem are counted. Each thread computes the
+// statistics of its own chunk, and the chunks are merged.
+SequenceStatistics computeStatistics(
+    long long n,
+    std::vector<std::string> regionNames,
+    int barcodeRegion,
+    int barcodeLoopLength,
+    std::function<void(long long, std::vector<const std::string*>&)> regionsOf
+    ) {
+    std::vector<SequenceStatistics> partials(NUM_THREADS, SequenceStatistics(regionNames));
+    std::vector<std::pair<uint64_t, long long> > sequenceHashes(n);
+    std::vector<std::vector<std::pair<uint64_t, long long> > > barcodeHashes(NUM_THREADS);
+
+    parallelFor(n, [&](long long begin, long long end, int thread) {
+        SequenceStatistics& partial = partials[thread];
+        std::vector<const std::string*> regions;
+        for (long long i = begin; i < end; i++) {
+            regions.clear();
+            regionsOf(i, regions);
+
+            // count the bases of every region, hashing the whole sequence
+            // (FNV-1a) on the way, so that it is only read once
+            uint64_t hash = 0xcbf29ce484222325ULL;
+            int position = 0;
+            for (int region = 0; region < regions.size(); region++) {
+                const std::string& sequence = *regions[region];
+                partial.regionLengths[region][sequence.size()]++;
+                if (partial.composition.size() < position + sequence.size()) {
+                    partial.composition.resize(position + sequence.size(), {0, 0, 0, 0, 0});
+                }
+                for (char base : sequence) {
+                    partial.composition[position++][statisticsBaseIndex(base)]++;
+                    hash = (hash ^ (unsigned char) base) * 0x100000001b3ULL;
+                }
+            }
+            partial.lengths[position]++;
+            partial.numSequences++;
+            sequenceHashes[i] = {hash, i};
+
+            // count the pairs of bases in the stem of the barcode
+            if (barcodeRegion < 0 || barcodeRegion >= regions.size()) {
+                continue;
+            }
+            const std::string& barcode = *regions[barcodeRegion];
+            if (barcode.empty() || barcode == "N") {
+                continue;
+            }
+            partial.numBarcodes++;
+            barcodeHashes[thread].push_back({std::hash<std::string>()(barcode), i});
+            int stemLength = std::max(0, ((int) barcode.size() - barcodeLoopLength) / 2);
+            for (int j = 0; j < stemLength; j++) {
+                int first = statisticsBaseIndex(barcode[j]);
+                int second = statisticsBaseIndex(barcode[barcode.size() - 1 - j]);
+                partial.barcodePairs[first][second]++;
+            }
+        }
+    });
+
+    SequenceStatistics statistics = SequenceStatistics(regionNames);
+    for (SequenceStatistics& partial : partials) {
+        statistics.merge(partial);
+    }
+
+    // count the duplicates, comparing the sequences themselves only where
+    // their hashes collide
+    std::vector<const std::string*> regions;
+    statistics.duplicateSequences = countDuplicates(sequenceHashes, [&](long long i) {
+        regions.clear();
+        regionsOf(i, regions);
+        std::string sequence;
+        for (const std::string* region : regions) {
+            sequence += *region;
+        }
+        return sequence;
+    });
+    std::vector<std::pair<uint64_t, long long> > allBarcodeHashes;
+    for (auto& threadHashes : barcodeHashes) {
+        allBarcodeHashes.insert(allBarcodeHashes.end(), threadHashes.begin(), threadHashes.end());
+    }
+    statistics.duplicateBarcodes = countDuplicates(allBarcodeHashes, [&](long long i) {
+        regions.clear();
+        regionsOf(i, regions);
+        return *regions[barcodeRegion];
+    });
+
+    return statistics;
+}
@@ -7,52 +7,135 @@
 #include <unordered_set>
 #include <fstream>
 #include <filesystem>
+#include <array>
 
 
 
 
 
 
-std::string generateRandomSequence(int length, std::vector<std::string> bases = RNA_BASES) {
-    // create a random number generator
-    std::random_device rd;
-    std::mt19937 gen(rd());
+std::string generateRandomSequence(int length, std::mt19937& gen, const std::vector<std::string>& bases = RNA_BASES) {
+    // RNA bases are written 32 to each random word
+    if (bases == RNA_BASES) {
+        std::string sequence(std::max(0, length), ' ');
+        fillRandomBases(&sequence[0], sequence.size(), gen);
+        return sequence;
+    }
 
     // create a uniform distribution for the nucleic bases
-    std::uniform_int_distribution<int> dist(0, 3);
+    std::uniform_int_distribution<int> dist(0, bases.size() - 1);
 
     // create a vector to store the sequence
     std::string sequence = "";
 
     // loop over the length of the sequence and sample a random nucleic base
     for (int i = 0; i < length; i++) {
-        sequence += bases[dist(rd)];
+        sequence += bases[dist(gen)];
     }
 
     return sequence;
 }
 
 
-std::vector<int> sampleBitVector(int length) {
+std::string generateRandomSequence(int length, std::vector<std::string> bases = RNA_BASES) {
     // create a random number generator
     std::random_device rd;
     std::mt19937 gen(rd());
 
-    // create a uniform distribution for the nucleic bases
-    std::uniform_int_distribution<int> dist(0, 1);
+    return generateRandomSequence(length, gen, bases);
+}
 
-    // create a vector to store the sequence
-    std::vector<int> sequence;
 
-    // loop over the length of the sequence and sample a random nucleic base
-    for (int i = 0; i < length; i++) {
-        sequence.push_back(dist(rd));
+// the number of candidates that are abandoned before giving up on generating
+// a sequence that satisfies the constraints
+const int CONSTRAINT_MAX_ATTEMPTS = 1000000;
+
+// the constraints used when none are given
+const SequenceConstraints NO_CONSTRAINTS;
+
+
+// append count random bases to sequence, checking each against the
+// constraints from the given state. The bases are tried in a random order, and
+// the function returns false as soon as none of them satisfy the constraints.
+bool appendConstrainedRandomBases(
+    std::string& sequence,
+    ConstraintState& state,
+    int count,
+    std::mt19937& gen,
+    const SequenceConstraints& constraints
+    ) {
+    for (int i = 0; i < count; i++) {
+        std::array<char, 4> bases = {'A', 'C', 'G', 'U'};
+        std::shuffle(bases.begin(), bases.end(), gen);
+        bool extended = false;
+        for (char base : bases) {
+            if (constraints.extend(state, sequence, base)) {
+                sequence += base;
+                extended = true;
+                break;
+            }
+        }
+        if (!extended) {
+            return false;
+        }
+    }
+    return true;
+}
+
+
+std::string generateRandomSequence(int length, std::mt19937& gen, const SequenceConstraints& constraints) {
+    if (!constraints.isEnabled()) {
+        return generateRandomSequence(length, gen);
     }
 
+    for (int attempt = 0; attempt < CONSTRAINT_MAX_ATTEMPTS; attempt++) {
+        std::string sequence = "";
+        ConstraintState state = constraints.start(length);
+        if (appendConstrainedRandomBases(sequence, state, length, gen, constraints)) {
+            return sequence;
+        }
+        METRICS.constraintPrunes.fetch_add(1, std::memory_order_relaxed);
+    }
+
+    std::cout << "Error: unable to generate a sequence of length " << length << " that satisfies the sequence constraints." << std::endl;
+    exit(EXIT_FAILURE);
+}
+
+
+std::vector<int> sampleBitVector(int length, std::mt19937& gen) {
+    // take 64 bits from each random word
+    std::vector<int> sequence(std::max(0, length));
+    fillRandomBits(sequence.data(), sequence.size(), gen);
+
     return sequence;
 }
 
 
+std::vector<int> sampleBitVector(int length) {
+    // create a random number generator
+    std::random_device rd;
+    std::mt19937 gen(rd());
+
+    return sampleBitVector(length, gen);
+}
+
+
+
+
+std::vector<int> sampleVectorOfIntegersWithOccurenceConstraints(
+    int length, 
+    int maxValue, 
+    std::vector<int> maxOccurences,
+    std::mt19937& gen
+    ) {
+
+    // draw how many of each value to take, and then their order, directly,
+    // rather than shuffling maxOccurences[i] copies of every value i
+    std::vector<int> sampledValues(length);
+    PairCompositionSampler(length, maxOccurences).sampleTypes(sampledValues.data(), gen);
+
+    return sampledValues;
+}
 
 
 std::vector<int> sampleVectorOfIntegersWithOccurenceConstraints(
@@ -65,21 +148,7 @@ std::vector<int> sampleVectorOfIntegersWithOccurenceConstraints(
     std::random_device rd;
     std::mt19937 gen(rd());
 
-    // create a vector containing maxOccurences[i] copies of i
-    std::vector<int> values;
-    for (int i = 0; i < maxOccurences.size(); i++) {
-        for (int j = 0; j < maxOccurences[i]; j++) {
-            values.push_back(i);
-        }
-    }
-
-    // shuffle the values vector
-    std::shuffle(values.begin(), values.end(), rd);
-
-    // get the first length elements of the values vector
-    std::vector<int> sampledValues(values.begin(), values.begin() + length);
-
-    return sampledValues;
+    return sampleVectorOfIntegersWithOccurenceConstraints(length, maxValue, maxOccurences, gen);
 }
 
 
@@ -96,32 +165,113 @@ class Barcode {
             this->stemLoop = stemLoop;
         }
 
+        Barcode(
+            int length,
+            std::vector<int> maxOccurences,
+            std::string stemLoop,
+            std::mt19937& gen,
+            const SequenceConstraints& constraints = NO_CONSTRAINTS,
+            const std::vector<uint8_t>& allowedPairs = {}
+            ) {
+
+            // generate the barcode base by base against the constraints, if
+            // there are any
+            if (constraints.isEnabled()) {
+                for (int attempt = 0; attempt < CONSTRAINT_MAX_ATTEMPTS; attempt++) {
+                    std::string sequence = "";
+                    ConstraintState state = constraints.start(2 * length + stemLoop.size());
+                    if (this->sampleWithConstraints(length, maxOccurences, stemLoop, gen, constraints, state, sequence, allowedPairs)) {
+                        return;
+                    }
+                    METRICS.constraintPrunes.fetch_add(1, std::memory_order_relaxed);
+                }
+                std::cout << "Error: unable to generate a barcode of length " << length << " that satisfies the sequence constraints." << std::endl;
+                exit(EXIT_FAILURE);
+            }
+
+            // initialise a barcode with a random sequence of base pairs, each
+            // of the three types modulo orientation drawn without replacement,
+            // and a random orientation, where each is allowed at its position,
+            // and the given stem loop
+            this->basePairs.resize(length);
+            sampleStemBasePairs(this->basePairs.data(), length, maxOccurences, gen, allowedPairs);
+
+            // set the stem loop
+            this->stemLoop = stemLoop;
+        }
+
         Barcode(int length, std::vector<int> maxOccurences, std::string stemLoop) {
 
-            // initialise a barcode with a random sequence of base pairs and
-            // the given stem loop
+            // initialise a barcode from a freshly seeded random number generator
+            std::random_device rd;
+            std::mt19937 gen(rd());
+            *this = Barcode(length, maxOccurences, stemLoop, gen);
+        }
+
+
+        // sample the base pairs of the barcode while checking the constraints
+        // incrementally along the 5' arm, the loop, and then the 3' arm, which
+        // is fixed by the 5' arm. The barcode is appended to sequence, which may
+        // already hold the bases before it, with the matching constraint state.
+        // The orientation of each pair is flipped if the sampled one violates
+        // the constraints, and the candidate is abandoned as soon as neither
+        // does. Only orientations allowed at each position are tried. Returns
+        // whether a valid barcode was found.
+        bool sampleWithConstraints(
+            int length,
+            std::vector<int> maxOccurences,
+            std::string stemLoop,
+            std::mt19937& gen,
+            const SequenceConstraints& constraints,
+            ConstraintState& state,
+            std::string& sequence,
+            const std::vector<uint8_t>& allowedPairs = {}
+            ) {
+            this->basePairs.resize(length);
+            sampleStemBasePairs(this->basePairs.data(), length, maxOccurences, gen, allowedPairs);
+            this->stemLoop = stemLoop;
+
+            // the 5' arm runs from the outermost pair inwards
+            for (int i = length - 1; i >= 0; i--) {
+                uint8_t allowed = i < allowedPairs.size() ? allowedPairs[i] : 0x3f;
+                int pair = -1;
+                for (int flip = 0; flip < 2 && pair < 0; flip++) {
+                    int candidate = this->basePairs[i] ^ flip;
+                    if (((allowed >> candidate) & 1) && constraints.extend(state, sequence, RNA_PAIRS[candidate][0][0])) {
+                        pair = candidate;
+                    }
+                }
+                if (pair < 0) {
+                    return false;
+                }
+                this->basePairs[i] = pair;
+                sequence += RNA_PAIRS[pair][0];
+            }
 
-            // generate a random sequence of 0s, 1, and 2s to represent the three
-            // possible base pairs modulo orientation
-            this -> basePairs = sampleVectorOfIntegersWithOccurenceConstraints(length, NUM_PAIRS_MODULO_ORIENTATION, maxOccurences);
+            for (char base : stemLoop) {
+                if (!constraints.extend(state, sequence, base)) {
+                    return false;
+                }
+                sequence += base;
+            }
 
-            // create a random bit vector to represent the orientation of the base pairs, 
-            // multiply the base pairs by two and add the bit vector to get the final base pairs
-            std::vector<int> bitVector = sampleBitVector(length);
+            // the 3' arm runs from the innermost pair outwards
             for (int i = 0; i < length; i++) {
-                this->basePairs[i] = 2 * this->basePairs[i] + bitVector[i];
+                if (!constraints.extend(state, sequence, RNA_PAIRS[this->basePairs[i]][1][0])) {
+                    return false;
+                }
+                sequence += RNA_PAIRS[this->basePairs[i]][1];
             }
 
-            // set the stem loop
-            this->stemLoop = stemLoop;
+            return true;
         }
 
 
         std::string toString() {
-            std::string stem = stemLoop;
-            for (int i = 0; i < basePairs.size(); i++) {
-                stem = RNA_PAIRS[basePairs[i]][0] + stem + RNA_PAIRS[basePairs[i]][1];
-            }
+            std::string stem(2 * this->basePairs.size() + this->stemLoop.size(), ' ');
+            withStemKernel(this->basePairs.size(), [&](auto kernel) {
+                kernel.write(&stem[0], this->basePairs.data(), this->basePairs.size(), this->stemLoop);
+            });
             return stem;
         }
 
@@ -194,56 +344,94 @@ class Barcode {
     bool verifyHammingDistance(std::unordered_set<std::string>& barcodesToAvoid) {
 
         // check if the current stem barcode has a hamming distance of at least 1
-        // from all the stem barcodes in the set
-
-        // get the hamming one ball
-        std::vector<Barcode> hammingOneBall = this->hammingOneBall();
+        // from all the stem barcodes in the set, probing the elements of the
+        // hamming one ball in place rather than building each of them
+        return withStemKernel(this->basePairs.size(), [&](auto kernel) {
+            return kernel.isFarFrom(this->basePairs.data(), this->basePairs.size(), this->stemLoop, barcodesToAvoid);
+        });
+    }
 
-        // check if any of the elements of the hamming one ball are in the set
-        for (int i = 0; i < hammingOneBall.size(); i++) {
-            if (barcodesToAvoid.find(hammingOneBall[i].toString()) != barcodesToAvoid.end()) {
-                return false;
-            }
-        }
 
-        return true;
+    // the same check against a bitmap of the barcodes of this length and loop,
+    // probing the bits of the hamming one ball directly
+    bool verifyHammingDistance(const BarcodeBitmap& barcodesToAvoid) {
+        return !barcodesToAvoid.containsNeighbourOf(this->basePairs.data());
     }
 };
 
 
-std::string getPadding(
+// decompose the padding required into the segments that getPadding fills it
+// with. Each positive entry is the length of a stem barcode, and each negative
+// entry is a run of that many random bases. A stem is only used where at least
+// one base pair fits around its loop, so any remainder shorter than that is
+// random bases.
+std::vector<int> getPaddingPlan(
     int paddingRequired,
     int minStemLength,
     int maxStemLength,
-    std::vector<int> maxOccurences,
-    std::string stemLoop
+    int stemLoopLength
     ) {
-        // initialise a string to store the padding
-        std::string padding;
-
-        // while the padding required is greater than zero, add either random bases
-        // or a stem barcode to the padding, depending on the value of paddingRequired
+        std::vector<int> plan;
         while (paddingRequired > 0) {
-            // if the padding required is less than the minimum stem length, add random bases
-            if (paddingRequired < minStemLength) {
-                padding += generateRandomSequence(paddingRequired);
-
-                // set the padding required to zero
+            if (paddingRequired < std::max(minStemLength, stemLoopLength + 2) || maxStemLength < 1) {
+                plan.push_back(-paddingRequired);
                 paddingRequired = 0;
             } else {
-                // otherwise, add a stem barcode of length min(maxStemLength, paddingRequired)
-                int largestStemRequried = (paddingRequired - stemLoop.size()) / 2;
+                int largestStemRequried = (paddingRequired - stemLoopLength) / 2;
                 int stemLength = std::min(maxStemLength, largestStemRequried);
+                plan.push_back(stemLength);
+                paddingRequired -= 2 * stemLength + stemLoopLength;
+            }
+        }
+        return plan;
+    }
 
-                Barcode stemBarcode = Barcode(stemLength, maxOccurences, stemLoop);
-
-                std::string stem = stemBarcode.toString();
 
-                padding += stem;
+std::string getPadding(
+    int paddingRequired,
+    int minStemLength,
+    int maxStemLength,
+    std::vector<int> maxOccurences,
+    std::string stemLoop,
+    std::mt19937& gen,
+    const SequenceConstraints& constraints = NO_CONSTRAINTS
+    ) {
+        // with constraints, the segments are generated one after the other
+        // against a single constraint state, so that the constraints also hold
+        // across the junctions between segments
+        if (constraints.isEnabled()) {
+            std::vector<int> plan = getPaddingPlan(paddingRequired, minStemLength, maxStemLength, stemLoop.size());
+            for (int attempt = 0; attempt < CONSTRAINT_MAX_ATTEMPTS; attempt++) {
+                std::string padding = "";
+                ConstraintState state = constraints.start(std::max(0, paddingRequired));
+                bool valid = true;
+                for (int i = 0; i < plan.size() && valid; i++) {
+                    if (plan[i] < 0) {
+                        valid = appendConstrainedRandomBases(padding, state, -plan[i], gen, constraints);
+                    } else {
+                        Barcode stemBarcode = Barcode({}, stemLoop);
+                        valid = stemBarcode.sampleWithConstraints(plan[i], maxOccurences, stemLoop, gen, constraints, state, padding);
+                    }
+                }
+                if (valid) {
+                    return padding;
+                }
+                METRICS.constraintPrunes.fetch_add(1, std::memory_order_relaxed);
+            }
+            std::cout << "Error: unable to generate padding of length " << paddingRequired << " that satisfies the sequence constraints." << std::endl;
+            exit(EXIT_FAILURE);
+        }
 
-                // update the padding required
-                paddingRequired -= stem.size();
+        // initialise a string to store the padding
+        std::string padding;
 
+        // add either random bases or a stem barcode for each segment of the
+        // padding, depending on the amount of padding required
+        for (int segment : getPaddingPlan(paddingRequired, minStemLength, maxStemLength, stemLoop.size())) {
+            if (segment < 0) {
+                padding += generateRandomSequence(-segment, gen, constraints);
+            } else {
+                padding += Barcode(segment, maxOccurences, stemLoop, gen, constraints).toString();
             }
         }
 
@@ -252,6 +440,21 @@ std::string getPadding(
     }
 
 
+std::string getPadding(
+    int paddingRequired,
+    int minStemLength,
+    int maxStemLength,
+    std::vector<int> maxOccurences,
+    std::string stemLoop
+    ) {
+        // create a random number generator
+        std::random_device rd;
+        std::mt19937 gen(rd());
+
+        return getPadding(paddingRequired, minStemLength, maxStemLength, maxOccurences, stemLoop, gen);
+    }
+
+
 
 
 std::string padSequence(
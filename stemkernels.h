@@ -0,0 +1,92 @@
+// stemkernels.h
+
+#include <cstring>
+#include <string>
+#include <unordered_set>
+
+
+// the base pairs one substitution away from each base pair, as in
+// Barcode::hammingOneBall, with -1 where there are fewer than two
+constexpr int STEM_NEIGHBOURS[6][2] = {{4, -1}, {5, -1}, {5, -1}, {4, -1}, {0, 3}, {1, 2}};
+
+
+// the kernels of a stem barcode, for a stem of L base pairs that is fixed at
+// compile time, so that their loops unroll, or, for L = 0, of any length
+template <int L>
+class StemKernel {
+    public:
+        // write the sequence of the barcode to out, which holds 2 * length
+        // plus the length of the loop bases. The last base pair is the
+        // outermost.
+        static void write(char* out, const int* basePairs, int length, const std::string& stemLoop) {
+            const int n = L > 0 ? L : length;
+            const int loopLength = stemLoop.size();
+            for (int i = 0; i < n; i++) {
+                out[i] = PAIR_FIVE_PRIME_BASES[basePairs[n - 1 - i]];
+                out[n + loopLength + i] = PAIR_THREE_PRIME_BASES[basePairs[i]];
+            }
+            std::memcpy(out + n, stemLoop.data(), loopLength);
+        }
+
+        // whether neither the barcode nor any barcode one base pair away from
+        // it is in the set. The barcode is written once, and each neighbour is
+        // probed by changing the two bases of one pair in place.
+        static bool isFarFrom(const int* basePairs, int length, const std::string& stemLoop, const std::unordered_set<std::string>& barcodes) {
+            const int n = L > 0 ? L : length;
+            const int loopLength = stemLoop.size();
+            thread_local std::string probe;
+            probe.resize(2 * n + loopLength);
+            char* bases = &probe[0];
+            StemKernel<L>::write(bases, basePairs, n, stemLoop);
+
+            long long probes = 0;
+            bool found = false;
+            for (int i = 0; i < n && !found; i++) {
+                char* five = bases + n - 1 - i;
+                char* three = bases + n + loopLength + i;
+                for (int neighbour : STEM_NEIGHBOURS[basePairs[i]]) {
+                    if (neighbour >= 0 && !found) {
+                        *five = PAIR_FIVE_PRIME_BASES[neighbour];
+                        *three = PAIR_THREE_PRIME_BASES[neighbour];
+                        probes++;
+                        found = barcodes.find(probe) != barcodes.end();
+                    }
+                }
+                *five = PAIR_FIVE_PRIME_BASES[basePairs[i]];
+                *three = PAIR_THREE_PRIME_BASES[basePairs[i]];
+            }
+            if (!found) {
+                probes++;
+                found = barcodes.find(probe) != barcodes.end();
+            }
+            METRICS.indexProbes.fetch_add(probes, std::memory_order_relaxed);
+            return !found;
+        }
+
+        // the base pairs of the stem as a number in base six, with the
+        // innermost pair the lowest digit
+        static long long index(const int* basePairs, int length) {
+            const int n = L > 0 ? L : length;
+            long long index = 0;
+            for (int i = n - 1; i >= 0; i--) {
+                index = 6 * index + basePairs[i];
+            }
+            return index;
+        }
+};
+
+
+// call f with the kernel compiled for a stem of length base pairs, or with
+// the generic one for other lengths, such as those of padding stems. f is
+// compiled once for each kernel, so the kernel calls within it are direct
+// and inline, and a loop over many stems in f pays for the dispatch once.
+template <typename F>
+auto withStemKernel(int length, F&& f) -> decltype(f(StemKernel<0>())) {
+    switch (length) {
+        case 8: return f(StemKernel<8>());
+        case 10: return f(StemKernel<10>());
+        case 13: return f(StemKernel<13>());
+        case 16: return f(StemKernel<16>());
+        default: return f(StemKernel<0>());
+    }
+}
@@ -0,0 +1,175 @@
+// synthetic.h
+
+#include <string>
+#include <vector>
+#include <random>
+#include <fstream>
+#include <iostream>
+
+
+// generate a random RNA sequence from a seeded generator, so that synthetic
+// workloads are reproducible
+std::string syntheticSequence(int length, std::mt19937_64& gen) {
+    static const char bases[] = {'A', 'C', 'G', 'U'};
+    std::string sequence(length, 'A');
+    for (int i = 0; i < length; i++) {
+        sequence[i] = bases[gen() & 3];
+    }
+    return sequence;
+}
+
+
+// the distributions that a synthetic library is drawn from
+typedef struct {
+    long long numRows;
+
+    // the possible design lengths, and their relative weights
+    std::vector<int> designLengths;
+    std::vector<double> designLengthWeights;
+
+    // the fraction of rows that already carry a barcode, that carry the null
+    // barcode N, and that repeat the design region of an earlier row
+    double fractionBarcoded;
+    double fractionNullBarcode;
+    double fractionDuplicateDesign;
+
+    // the fraction of pre-existing barcodes that repeat an earlier barcode
+    double fractionDuplicateBarcode;
+
+    // the shape of the pre-existing barcodes
+    int barcodeLength;
+    std::string barcodeStemLoop;
+
+    unsigned long long seed;
+} SyntheticLibraryConfig;
+
+
+SyntheticLibraryConfig defaultSyntheticLibraryConfig() {
+    SyntheticLibraryConfig config;
+    config.numRows = 10000;
+    config.designLengths = {40, 60, 80};
+    config.designLengthWeights = {1, 1, 1};
+    config.fractionBarcoded = 0;
+    config.fractionNullBarcode = 0;
+    config.fractionDuplicateDesign = 0;
+    config.fractionDuplicateBarcode = 0;
+    config.barcodeLength = 13;
+    config.barcodeStemLoop = "UUCG";
+    config.seed = 42;
+    return config;
+}
+
+
+// a hairpin barcode drawn from a seeded generator, with the same shape as
+// those produced by Barcode::toString
+std::string syntheticBarcode(int length, std::string stemLoop, std::mt19937_64& gen) {
+    static const char* pairs[] = {"AU", "UA", "CG", "GC", "GU", "UG"};
+    std::string fivePrime(length, 'A');
+    std::string threePrime(length, 'A');
+    for (int i = 0; i < length; i++) {
+        const char* pair = pairs[gen() % 6];
+        fivePrime[length - 1 - i] = pair[0];
+        threePrime[i] = pair[1];
+    }
+    return fivePrime + stemLoop + threePrime;
+}
+
+
+// stream a library CSV with the seven columns expected by Library::readFromCSV.
+// Rows are written as they are generated; only a bounded window of recent
+// design regions and barcodes is kept so that duplicates can be drawn from it.
+void writeSyntheticLibraryCSV(std::ostream& file, SyntheticLibraryConfig config) {
+    std::mt19937_64 gen(config.seed);
+    std::uniform_real_distribution<double> uniform(0, 1);
+    std::discrete_distribution<int> lengthDistribution(config.designLengthWeights.begin(), config.designLengthWeights.end());
+
+    const int windowSize = 4096;
+    std::vector<std::string> recentDesigns;
+    std::vector<std::string> recentBarcodes;
+
+    file << "Name,5' Constant Region,5' Padding,Design Region,3' Padding,Barcode,3' Constant Region\n";
+    for (long long i = 0; i < config.numRows; i++) {
+
+        // draw the design region, possibly repeating an earlier one
+        std::string design;
+        if (!recentDesigns.empty() && uniform(gen) < config.fractionDuplicateDesign) {
+            design = recentDesigns[gen() % recentDesigns.size()];
+        } else {
+            design = syntheticSequence(config.designLengths[lengthDistribution(gen)], gen);
+            if (recentDesigns.size() < windowSize) {
+                recentDesigns.push_back(design);
+            } else {
+                recentDesigns[gen() % windowSize] = design;
+            }
+        }
+
+        // draw the barcode, which is either absent, null, or a hairpin that may
+        // repeat an earlier one
+        std::string barcode;
+        double draw = uniform(gen);
+        if (draw < config.fractionNullBarcode) {
+            barcode = "N";
+        } else if (draw < config.fractionNullBarcode + config.fractionBarcoded) {
+            if (!recentBarcodes.empty() && uniform(gen) < config.fractionDuplicateBarcode) {
+                barcode = recentBarcodes[gen() % recentBarcodes.size()];
+            } else {
+                barcode = syntheticBarcode(config.barcodeLength, config.barcodeStemLoop, gen);
+                if (recentBarcodes.size() < windowSize) {
+                    recentBarcodes.push_back(barcode);
+                } else {
+                    recentBarcodes[gen() % windowSize] = barcode;
+                }
+            }
+        }
+
+        file << "design_" << i << ",,," << design << ",," << barcode << ",\n";
+    }
+}
+
+
+// write a library CSV of numSequences fresh designs, where the design lengths
+// are drawn uniformly from designLengths
+void writeSyntheticLibraryCSV(
+    std::string filename,
+    long long numSequences,
+    std::vector<int> designLengths,
+    unsigned long long seed
+    ) {
+    std::ofstream file(filename);
+    if (!file.is_open()) {
+        std::cerr << "Unable to open file: " << filename << std::endl;
+        exit(EXIT_FAILURE);
+    }
+    SyntheticLibraryConfig config = defaultSyntheticLibraryConfig();
+    config.numRows = numSequences;
+    config.designLengths = designLengths;
+    config.designLengthWeights = std::vector<double>(designLengths.size(), 1);
+    config.seed = seed;
+    writeSyntheticLibraryCSV(file, config);
+}
+
+
+// write a fasta file of random sequences, wrapping each sequence over
+// several lines as is common for real fasta files
+void writeSyntheticFasta(
+    std::string filename,
+    long long numSequences,
+    std::vector<int> lengths,
+    unsigned long long seed,
+    int lineWidth = 60
+    ) {
+    std::mt19937_64 gen(seed);
+    std::ofstream file(filename);
+    if (!file.is_open()) {
+        std::cerr << "Unable to open file: " << filename << std::endl;
+        exit(EXIT_FAILURE);
+    }
+    for (long long i = 0; i < numSequences; i++) {
+        int length = lengths[gen() % lengths.size()];
+        std::string sequence = syntheticSequence(length, gen);
+        file << ">sequence_" << i << "\n";
+        for (int j = 0; j < length; j += lineWidth) {
+            file << sequence.substr(j, lineWidth) << "\n";
+        }
+    }
+}